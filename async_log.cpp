@@ -0,0 +1,147 @@
+#include "async_log.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+
+AsyncLog::AsyncLog(size_t slots)
+{
+  size_t size = 1;
+  while (size < slots) {
+    size <<= 1;
+  }
+  slots_.reset(new Slot[size]);
+  mask_ = size - 1;
+  for (size_t i = 0; i < size; ++i) {
+    slots_[i].sequence_.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread(&AsyncLog::drain, this);
+}
+
+
+AsyncLog::~AsyncLog()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_one();
+  thread_.join();
+}
+
+
+void AsyncLog::set_debug(bool enabled, std::chrono::milliseconds dump_interval)
+{
+  dump_interval_ = std::chrono::duration_cast<std::chrono::nanoseconds>(dump_interval).count();
+  debug_ = enabled;
+}
+
+
+void AsyncLog::write(const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vwrite(format, args);
+  va_end(args);
+}
+
+
+void AsyncLog::write_debug(const char* format, ...)
+{
+  if (!debug()) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vwrite(format, args);
+  va_end(args);
+}
+
+
+void AsyncLog::dump(const char* label, const std::string& payload)
+{
+  if (!debug()) {
+    return;
+  }
+
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  int64_t next = next_dump_.load(std::memory_order_relaxed);
+  if (now < next || !next_dump_.compare_exchange_strong(next, now + dump_interval_.load(std::memory_order_relaxed))) {
+    return;
+  }
+
+  // The prefix takes part of the slot, the rest of the payload is cut off by the slot size.
+  write("%s (%zu bytes): %.*s", label, payload.size(), static_cast<int>(slot_size), payload.c_str());
+}
+
+
+void AsyncLog::vwrite(const char* format, va_list args)
+{
+  size_t position;
+  if (!claim(position)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  auto& slot = slots_[position & mask_];
+  int length = std::vsnprintf(slot.text_, slot_size - 1, format, args);
+  if (length < 0) {
+    length = 0;
+  } else if (static_cast<size_t>(length) > slot_size - 2) {
+    length = slot_size - 2;
+  }
+  slot.text_[length] = '\n';
+  slot.length_ = length + 1;
+  slot.sequence_.store(position + 1, std::memory_order_release);
+}
+
+
+bool AsyncLog::claim(size_t& position)
+{
+  // Bounded MPMC ring after Dmitry Vyukov, with a single consumer. The sequence of a slot is its position while it is
+  // free, position + 1 once it is written and position + size after it has been read.
+  position = enqueue_.load(std::memory_order_relaxed);
+  for (;;) {
+    auto& slot = slots_[position & mask_];
+    size_t sequence = slot.sequence_.load(std::memory_order_acquire);
+    auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+    if (difference == 0) {
+      if (enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        return true;
+      }
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = enqueue_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+
+void AsyncLog::drain()
+{
+  for (;;) {
+    bool written = false;
+    for (;;) {
+      auto& slot = slots_[dequeue_ & mask_];
+      if (slot.sequence_.load(std::memory_order_acquire) != dequeue_ + 1) {
+        break;
+      }
+      std::fwrite(slot.text_, 1, slot.length_, stdout);
+      slot.sequence_.store(dequeue_ + mask_ + 1, std::memory_order_release);
+      ++dequeue_;
+      written = true;
+    }
+    if (written) {
+      std::fflush(stdout);
+    }
+
+    // Writers do not signal, waking up on every message would cost them a syscall. The ring is polled instead.
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_ && slots_[dequeue_ & mask_].sequence_.load(std::memory_order_acquire) != dequeue_ + 1) {
+      return;
+    }
+    stop_condition_.wait_for(lock, std::chrono::milliseconds(10));
+  }
+}
@@ -0,0 +1,95 @@
+/// @file async_log.h
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+/// @brief Console log which keeps the I/O off the calling threads.
+/// Messages are formatted straight into the slots of a bounded lock-free ring, which is drained to stdout by a
+/// background thread. Writers never block and never allocate: if the ring is full the message is dropped and counted.
+/// Messages longer than a slot are truncated. Thread safe.
+class AsyncLog
+{
+public:
+  static const size_t slot_size = 256; ///< Maximum length of a message including the newline.
+
+  /// Constructs the log and starts the background thread.
+  /// @param slots Number of slots of the ring, rounded up to a power of two.
+  explicit AsyncLog(size_t slots = 1024);
+
+  /// Writes the remaining messages and stops the background thread.
+  ~AsyncLog();
+
+  AsyncLog(const AsyncLog&) = delete;
+  AsyncLog& operator=(const AsyncLog&) = delete;
+
+  /// Enables debug messages and payload dumps.
+  /// @param enabled true to enable them.
+  /// @param dump_interval Minimum time between two payload dumps, the ones in between are skipped.
+  void set_debug(bool enabled, std::chrono::milliseconds dump_interval);
+
+  /// Returns whether debug messages are enabled. Callers can check this before collecting the arguments of a message.
+  /// @return true if enabled.
+  bool debug() const
+  {
+    return debug_.load(std::memory_order_relaxed);
+  }
+
+  /// Writes a message.
+  /// @param format printf format of the message, without newline.
+  void write(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  /// Writes a debug message if debug messages are enabled.
+  /// @param format printf format of the message, without newline.
+  void write_debug(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  /// Writes the beginning of a payload, e.g. a response body, if debug messages are enabled and the last dump is at
+  /// least the dump interval ago.
+  /// @param label Describes the payload.
+  /// @param payload The payload.
+  void dump(const char* label, const std::string& payload);
+
+  /// Returns the number of messages dropped because the ring was full.
+  /// @return The number of messages.
+  uint64_t dropped() const
+  {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t> sequence_;
+    size_t length_;
+    char text_[slot_size];
+  };
+
+  void vwrite(const char* format, va_list args);
+  bool claim(size_t& position);
+  void drain();
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> enqueue_{0};
+  alignas(64) size_t dequeue_{0}; ///< Only used by the background thread.
+
+  std::atomic<bool> debug_{false};
+  std::atomic<int64_t> dump_interval_{0};
+  std::atomic<int64_t> next_dump_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_{false};
+  std::thread thread_;
+};
@@ -0,0 +1,134 @@
+#include "catalog_tree.h"
+
+#include <algorithm>
+
+
+void CatalogTree::build(const CityTable& table)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  cities_.clear();
+  countries_.clear();
+  cities_.reserve(table.size());
+  for (const auto& city : table) {
+    cities_.push_back(&city);
+  }
+  // Stable, so the cities of a country stay sorted by id.
+  std::stable_sort(cities_.begin(), cities_.end(), [](const City* lhs, const City* rhs) {
+    return std::lexicographical_compare(lhs->country_, lhs->country_ + 2, rhs->country_, rhs->country_ + 2);
+  });
+
+  for (size_t begin = 0; begin < cities_.size();) {
+    size_t end = begin + 1;
+    while (end < cities_.size() && std::equal(cities_[end]->country_, cities_[end]->country_ + 2, cities_[begin]->country_)) {
+      ++end;
+    }
+    auto& entry = countries_[country(*cities_[begin])];
+    entry.begin_ = begin;
+    entry.end_ = end;
+    begin = end;
+  }
+}
+
+
+std::vector<std::string> CatalogTree::countries() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> names;
+  names.reserve(countries_.size());
+  for (const auto& entry : countries_) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+
+bool CatalogTree::materialize(const std::string& country, Clock::time_point now, std::vector<const City*>& cities)
+{
+  cities.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = countries_.find(country);
+  if (found == countries_.end()) {
+    return false;
+  }
+  auto& entry = found->second;
+  entry.used_ = now;
+  // An evicting country is materialized again by the list of its recreated node.
+  if (entry.state_ == Empty) {
+    entry.state_ = Materialized;
+    cities.assign(cities_.begin() + entry.begin_, cities_.begin() + entry.end_);
+  }
+  return true;
+}
+
+
+void CatalogTree::used(const std::string& country, Clock::time_point now)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = countries_.find(country);
+  if (found != countries_.end()) {
+    found->second.used_ = now;
+  }
+}
+
+
+void CatalogTree::changed(const std::string& country, bool subscribe, Clock::time_point now)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = countries_.find(country);
+  if (found == countries_.end()) {
+    return;
+  }
+  auto& entry = found->second;
+  entry.used_ = now;
+  if (subscribe) {
+    ++entry.subscribers_;
+  } else if (entry.subscribers_ > 0) {
+    --entry.subscribers_;
+  }
+}
+
+
+std::vector<std::string> CatalogTree::evict(Clock::time_point now, Clock::duration idle)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> names;
+  for (auto& entry : countries_) {
+    auto& country = entry.second;
+    if (country.state_ == Materialized && country.subscribers_ == 0 && now - country.used_ >= idle) {
+      country.state_ = Evicting;
+      names.push_back(entry.first);
+    }
+  }
+  return names;
+}
+
+
+void CatalogTree::evicted(const std::string& country)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = countries_.find(country);
+  if (found != countries_.end() && found->second.state_ == Evicting) {
+    found->second.state_ = Empty;
+    found->second.subscribers_ = 0;
+  }
+}
+
+
+size_t CatalogTree::materialized() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const auto& entry : countries_) {
+    if (entry.second.state_ == Materialized) {
+      count += entry.second.end_ - entry.second.begin_;
+    }
+  }
+  return count;
+}
+
+
+std::string CatalogTree::country(const City& city)
+{
+  auto code = CityTable::country(city);
+  return code.empty() ? std::string("unknown") : code;
+}
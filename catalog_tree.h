@@ -0,0 +1,91 @@
+/// @file catalog_tree.h
+
+#pragma once
+
+#include "city_catalog.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// @brief State of the browsable /catalog/<country>/<city> tree.
+/// Only the country level exists permanently. The city nodes of a country are materialized when the country is listed
+/// and evicted again when the country has been idle for a while, so the number of nodes follows the interest of the
+/// clients and not the size of the catalog. A country is in use while its cities have subscribers, and for the idle
+/// time after any of its nodes was listed or subscribed. Thread safe.
+class CatalogTree
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// Groups the cities of a table by country. The tree refers to the records of the table.
+  /// @param table The cities.
+  void build(const CityTable& table);
+
+  /// Returns the node names of the countries, the ISO 3166 codes and `unknown` for cities without country.
+  /// @return The names, sorted.
+  std::vector<std::string> countries() const;
+
+  /// Marks a country as used and as materialized.
+  /// @param country Node name of the country.
+  /// @param now The current time.
+  /// @param cities Receives the cities of the country if its city nodes have to be created, otherwise it is cleared.
+  /// @return false if the country is unknown.
+  bool materialize(const std::string& country, Clock::time_point now, std::vector<const City*>& cities);
+
+  /// Marks a country as used, e.g. when a list of one of its city nodes is opened, so it is not evicted under an open
+  /// list.
+  /// @param country Node name of the country.
+  /// @param now The current time.
+  void used(const std::string& country, Clock::time_point now);
+
+  /// Counts a subscribe or unsubscribe of a city node. A country with subscribed cities is never evicted.
+  /// @param country Node name of the country.
+  /// @param subscribe true for a subscribe, false for an unsubscribe.
+  /// @param now The current time.
+  void changed(const std::string& country, bool subscribe, Clock::time_point now);
+
+  /// Returns the countries whose city nodes have not been used for a while and marks them as evicting.
+  /// @param now The current time.
+  /// @param idle Time after the last use a country is evicted.
+  /// @return Node names of the countries whose city nodes have to be removed.
+  std::vector<std::string> evict(Clock::time_point now, Clock::duration idle);
+
+  /// Marks an evicted country as empty once its city nodes have been removed, so it is materialized again on the next
+  /// list.
+  /// @param country Node name of the country.
+  void evicted(const std::string& country);
+
+  /// Returns the number of materialized city nodes.
+  /// @return The number of nodes.
+  size_t materialized() const;
+
+  /// Returns the node name of the country of a city.
+  /// @param city The city.
+  /// @return The node name.
+  static std::string country(const City& city);
+
+private:
+  enum State
+  {
+    Empty,
+    Materialized,
+    Evicting
+  };
+
+  struct Country
+  {
+    size_t begin_{0};  ///< First city in cities_.
+    size_t end_{0};    ///< Past the last city in cities_.
+    State state_{Empty};
+    int subscribers_{0};
+    Clock::time_point used_;
+  };
+
+  mutable std::mutex mutex_;
+  std::vector<const City*> cities_; ///< The cities, grouped by country.
+  std::map<std::string, Country> countries_;
+};
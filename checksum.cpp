@@ -0,0 +1,34 @@
+#include "checksum.h"
+
+
+namespace
+{
+struct Crc32Table
+{
+  uint32_t entries_[256];
+
+  Crc32Table()
+  {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+      }
+      entries_[i] = crc;
+    }
+  }
+};
+
+const Crc32Table table;
+}
+
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc)
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table.entries_[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,14 @@
+/// @file checksum.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+/// Computes the CRC-32 (IEEE 802.3 polynomial) of a memory range. Can be chained by passing the previous result.
+/// @param data Start of the memory range.
+/// @param size Size of the memory range in bytes.
+/// @param crc The CRC of the preceding data or 0.
+/// @return The CRC of the memory range.
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
@@ -0,0 +1,425 @@
+#include "city_catalog.h"
+#include "checksum.h"
+#include "error_code.h"
+#include "gzip_stream.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/reader.h"
+
+#include <efm_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace rapidjson;
+
+
+namespace
+{
+// Catalog file layout, all integers in host byte order:
+//   CatalogHeader, padded to header_size
+//   city_count * City, sorted by id
+//   names_size bytes of names
+const char catalog_magic[8] = {'O', 'W', 'M', 'C', 'I', 'T', 'Y', '\0'};
+const uint32_t catalog_version = 1;
+const size_t header_size = 64;
+
+struct CatalogHeader
+{
+  char magic_[8];
+  uint32_t version_;
+  uint32_t record_size_;
+  uint32_t city_count_;
+  uint32_t names_size_;
+  uint32_t checksum_; ///< CRC-32 of the header with this field set to 0.
+};
+
+static_assert(sizeof(CatalogHeader) <= header_size, "catalog header does not fit");
+
+uint32_t header_checksum(CatalogHeader header)
+{
+  header.checksum_ = 0;
+  return crc32(&header, sizeof(header));
+}
+
+struct Mapping
+{
+  void* address_;
+  size_t size_;
+
+  Mapping(void* address, size_t size)
+    : address_(address), size_(size)
+  {
+  }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  ~Mapping()
+  {
+    munmap(address_, size_);
+  }
+};
+
+
+/// SAX handler for the city list, an array of
+/// {"id": 2643743, "name": "London", "state": "", "country": "GB", "coord": {"lon": -0.12574, "lat": 51.50853}}.
+/// Unknown members are skipped. The strings of the current city are reused, so no allocation is done per city once
+/// they have grown to the longest name.
+class CityListHandler : public BaseReaderHandler<UTF8<>, CityListHandler>
+{
+public:
+  explicit CityListHandler(CityTable& table)
+    : table_(table)
+  {
+  }
+
+  bool StartObject()
+  {
+    if (++depth_ == 1) {
+      id_ = 0;
+      name_.clear();
+      country_.clear();
+      has_id_ = has_latitude_ = has_longitude_ = false;
+    }
+    key_ = Other;
+    return true;
+  }
+
+  bool EndObject(SizeType)
+  {
+    if (depth_-- == 1 && has_id_ && has_latitude_ && has_longitude_) {
+      table_.add(id_, name_, country_, latitude_, longitude_);
+    }
+    key_ = Other;
+    return true;
+  }
+
+  bool Key(const Ch* str, SizeType length, bool)
+  {
+    key_ = Other;
+    if (depth_ == 1) {
+      if (equals(str, length, "id")) {
+        key_ = Id;
+      } else if (equals(str, length, "name")) {
+        key_ = Name;
+      } else if (equals(str, length, "country")) {
+        key_ = Country;
+      }
+    } else if (depth_ == 2) {
+      if (equals(str, length, "lat")) {
+        key_ = Latitude;
+      } else if (equals(str, length, "lon")) {
+        key_ = Longitude;
+      }
+    }
+    return true;
+  }
+
+  bool String(const Ch* str, SizeType length, bool)
+  {
+    if (key_ == Name) {
+      name_.assign(str, length);
+    } else if (key_ == Country) {
+      country_.assign(str, length);
+    }
+    return true;
+  }
+
+  bool Int(int i)
+  {
+    return number(i);
+  }
+  bool Uint(unsigned u)
+  {
+    return number(u);
+  }
+  bool Int64(int64_t i)
+  {
+    return number(static_cast<double>(i));
+  }
+  bool Uint64(uint64_t u)
+  {
+    return number(static_cast<double>(u));
+  }
+  bool Double(double d)
+  {
+    return number(d);
+  }
+
+  bool Default()
+  {
+    return true;
+  }
+
+private:
+  enum Field
+  {
+    Other,
+    Id,
+    Name,
+    Country,
+    Latitude,
+    Longitude
+  };
+
+  static bool equals(const Ch* str, SizeType length, const char* key)
+  {
+    return std::strlen(key) == length && std::memcmp(str, key, length) == 0;
+  }
+
+  bool number(double value)
+  {
+    switch (key_) {
+      case Id:
+        if (value >= 0 && value <= std::numeric_limits<uint32_t>::max()) {
+          id_ = static_cast<uint32_t>(value);
+          has_id_ = true;
+        }
+        break;
+      case Latitude:
+        latitude_ = static_cast<float>(value);
+        has_latitude_ = true;
+        break;
+      case Longitude:
+        longitude_ = static_cast<float>(value);
+        has_longitude_ = true;
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  CityTable& table_;
+  int depth_{0};
+  Field key_{Other};
+
+  uint32_t id_{0};
+  std::string name_;
+  std::string country_;
+  float latitude_{0};
+  float longitude_{0};
+  bool has_id_{false};
+  bool has_latitude_{false};
+  bool has_longitude_{false};
+};
+}
+
+
+CityTable::CityTable(CityTable&& other) noexcept
+{
+  *this = std::move(other);
+}
+
+
+CityTable& CityTable::operator=(CityTable&& other) noexcept
+{
+  records_ = std::move(other.records_);
+  pool_ = std::move(other.pool_);
+  mapping_ = std::move(other.mapping_);
+  cities_ = other.cities_;
+  count_ = other.count_;
+  names_ = other.names_;
+  names_size_ = other.names_size_;
+  if (!mapping_) {
+    attach(); // the string pool may have moved
+  }
+  other.records_.clear();
+  other.pool_.clear();
+  other.attach();
+  return *this;
+}
+
+
+void CityTable::add(uint32_t id, const std::string& name, const std::string& country, float latitude, float longitude)
+{
+  City city;
+  city.id_ = id;
+  city.latitude_ = latitude;
+  city.longitude_ = longitude;
+  city.name_ = static_cast<uint32_t>(pool_.size());
+  city.name_length_ = static_cast<uint16_t>(std::min<size_t>(name.size(), std::numeric_limits<uint16_t>::max()));
+  city.country_[0] = country.size() > 0 ? country[0] : '\0';
+  city.country_[1] = country.size() > 1 ? country[1] : '\0';
+  pool_.append(name, 0, city.name_length_);
+  records_.push_back(city);
+}
+
+
+void CityTable::finish()
+{
+  std::stable_sort(records_.begin(), records_.end(), [](const City& a, const City& b) { return a.id_ < b.id_; });
+  records_.shrink_to_fit();
+  pool_.shrink_to_fit();
+  mapping_.reset();
+  attach();
+}
+
+
+const City* CityTable::find(uint32_t id) const
+{
+  auto it = std::lower_bound(begin(), end(), id, [](const City& city, uint32_t value) { return city.id_ < value; });
+  return it != end() && it->id_ == id ? it : nullptr;
+}
+
+
+std::string CityTable::name(const City& city) const
+{
+  // Offsets of a mapped catalog are not trusted.
+  if (city.name_ > names_size_ || city.name_length_ > names_size_ - city.name_) {
+    return std::string();
+  }
+  return std::string(names_ + city.name_, city.name_length_);
+}
+
+
+std::string CityTable::country(const City& city)
+{
+  return std::string(city.country_, strnlen(city.country_, sizeof(city.country_)));
+}
+
+
+size_t CityTable::memory_usage() const
+{
+  return records_.capacity() * sizeof(City) + pool_.capacity();
+}
+
+
+bool CityTable::save(const std::string& file_name) const
+{
+  CatalogHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic_, catalog_magic, sizeof(catalog_magic));
+  header.version_ = catalog_version;
+  header.record_size_ = sizeof(City);
+  header.city_count_ = static_cast<uint32_t>(count_);
+  header.names_size_ = static_cast<uint32_t>(names_size_);
+  header.checksum_ = header_checksum(header);
+  char padded[header_size] = {};
+  std::memcpy(padded, &header, sizeof(header));
+
+  std::string temp_name = file_name + ".tmp";
+  std::FILE* file = std::fopen(temp_name.c_str(), "wb");
+  if (!file) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, temp_name << ": " << std::strerror(errno));
+    return false;
+  }
+  bool written = std::fwrite(padded, 1, sizeof(padded), file) == sizeof(padded) &&
+                 std::fwrite(cities_, sizeof(City), count_, file) == count_ &&
+                 std::fwrite(names_, 1, names_size_, file) == names_size_ && std::fflush(file) == 0 &&
+                 fsync(fileno(file)) == 0;
+  written = std::fclose(file) == 0 && written;
+  if (!written || std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": " << std::strerror(errno));
+    std::remove(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+bool CityTable::map(const std::string& file_name)
+{
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < header_size) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": truncated");
+    close(fd);
+    return false;
+  }
+  auto size = static_cast<size_t>(info.st_size);
+  void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": " << std::strerror(errno));
+    return false;
+  }
+  auto mapping = std::make_shared<Mapping>(address, size);
+
+  const auto& header = *static_cast<const CatalogHeader*>(address);
+  if (std::memcmp(header.magic_, catalog_magic, sizeof(catalog_magic)) != 0 || header.version_ != catalog_version ||
+      header.record_size_ != sizeof(City) || header.checksum_ != header_checksum(header) ||
+      header_size + static_cast<size_t>(header.city_count_) * sizeof(City) + header.names_size_ != size) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": invalid header");
+    return false;
+  }
+
+  std::vector<City>().swap(records_);
+  std::string().swap(pool_);
+  mapping_ = mapping;
+  cities_ = reinterpret_cast<const City*>(static_cast<const char*>(address) + header_size);
+  count_ = header.city_count_;
+  names_ = reinterpret_cast<const char*>(cities_ + count_);
+  names_size_ = header.names_size_;
+  return true;
+}
+
+
+void CityTable::attach()
+{
+  cities_ = records_.data();
+  count_ = records_.size();
+  names_ = pool_.data();
+  names_size_ = pool_.size();
+}
+
+
+bool import_city_list(const std::string& file_name, CityTable& table)
+{
+  std::FILE* file = std::fopen(file_name.c_str(), "rb");
+  if (!file) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": " << std::strerror(errno));
+    return false;
+  }
+
+  CityTable imported;
+  CityListHandler handler(imported);
+  GzipReadStream stream(file);
+  Reader reader;
+  ParseResult result = reader.Parse(stream, handler);
+  std::fclose(file);
+
+  if (stream.failed()) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error, file_name << ": read error at " << stream.Tell());
+    return false;
+  }
+  if (result.IsError()) {
+    LOG_EFM_ERROR(responder_error_code::city_catalog_error,
+      file_name << ": " << GetParseError_En(result.Code()) << " at " << result.Offset());
+    return false;
+  }
+
+  imported.finish();
+  table = std::move(imported);
+  return true;
+}
+
+
+bool load_cities(const std::string& city_list, const std::string& catalog_file, CityTable& table)
+{
+  struct stat list_info, catalog_info;
+  bool has_list = !city_list.empty() && stat(city_list.c_str(), &list_info) == 0;
+  bool has_catalog = !catalog_file.empty() && stat(catalog_file.c_str(), &catalog_info) == 0;
+
+  if (has_catalog && (!has_list || catalog_info.st_mtime >= list_info.st_mtime) && table.map(catalog_file)) {
+    return true;
+  }
+  if (city_list.empty() || !import_city_list(city_list, table)) {
+    return false;
+  }
+  // Map the saved catalog, so its pages are shared with other links instead of keeping a private copy.
+  if (!catalog_file.empty() && table.save(catalog_file)) {
+    table.map(catalog_file);
+  }
+  return true;
+}
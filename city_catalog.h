@@ -0,0 +1,127 @@
+/// @file city_catalog.h
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/// A city of the OpenWeatherMap catalog. Fixed size, the name is stored in the string pool of the CityTable. This is
+/// also the record layout of the catalog file.
+struct City
+{
+  uint32_t id_;          ///< OpenWeatherMap city id.
+  float latitude_;       ///< Latitude in degrees.
+  float longitude_;      ///< Longitude in degrees.
+  uint32_t name_;        ///< Offset of the name in the string pool.
+  uint16_t name_length_; ///< Length of the name in bytes.
+  char country_[2];      ///< ISO 3166 country code, zero filled if unknown.
+};
+
+static_assert(sizeof(City) == 20, "the catalog file depends on the layout of City");
+
+
+/// @brief Compact table of the cities of the OpenWeatherMap catalog.
+/// The records are sorted by id once the table is complete. Names are kept in one string pool, so the table needs
+/// around 30 bytes per city. A complete table can be saved to a catalog file, which is mapped read-only by later
+/// starts instead of importing the city list again. The pages of a mapped catalog are shared by all processes mapping
+/// the same file.
+class CityTable
+{
+public:
+  CityTable() = default;
+  CityTable(CityTable&& other) noexcept;
+  CityTable& operator=(CityTable&& other) noexcept;
+
+  /// Adds a city. finish has to be called after the last one.
+  /// @param id OpenWeatherMap city id.
+  /// @param name Name of the city.
+  /// @param country ISO 3166 country code.
+  /// @param latitude Latitude in degrees.
+  /// @param longitude Longitude in degrees.
+  void add(uint32_t id, const std::string& name, const std::string& country, float latitude, float longitude);
+
+  /// Sorts the cities by id and releases unused capacity.
+  void finish();
+
+  /// Returns the number of cities.
+  /// @return The number of cities.
+  size_t size() const
+  {
+    return count_;
+  }
+
+  /// Returns the first city, the cities are sorted by id.
+  /// @return The first city.
+  const City* begin() const
+  {
+    return cities_;
+  }
+
+  /// Returns the end of the cities.
+  /// @return Past the last city.
+  const City* end() const
+  {
+    return cities_ + count_;
+  }
+
+  /// Returns the city with the given id.
+  /// @param id OpenWeatherMap city id.
+  /// @return The city or nullptr if there is none with this id.
+  const City* find(uint32_t id) const;
+
+  /// Returns the name of a city of this table.
+  /// @param city The city.
+  /// @return The name.
+  std::string name(const City& city) const;
+
+  /// Returns the country code of a city.
+  /// @param city The city.
+  /// @return The country code, empty if unknown.
+  static std::string country(const City& city);
+
+  /// Returns the heap memory used by the table, a mapped catalog uses none.
+  /// @return The memory in bytes.
+  size_t memory_usage() const;
+
+  /// Writes the table to a catalog file. The file is written to a temporary file first and renamed over the old one,
+  /// so processes which have mapped the old catalog keep using it.
+  /// @param file_name The catalog file.
+  /// @return false if the file could not be written.
+  bool save(const std::string& file_name) const;
+
+  /// Replaces the table by a mapped catalog file. Only the header is read, so this takes constant time.
+  /// @param file_name The catalog file.
+  /// @return false if the file is missing, of another version or invalid. The table is unchanged then.
+  bool map(const std::string& file_name);
+
+private:
+  void attach();
+
+  std::vector<City> records_;
+  std::string pool_;
+  std::shared_ptr<const void> mapping_;
+
+  const City* cities_{nullptr};
+  size_t count_{0};
+  const char* names_{nullptr};
+  size_t names_size_{0};
+};
+
+
+/// Imports the OpenWeatherMap bulk city list (city.list.json or city.list.json.gz). The file is decompressed and
+/// parsed while it is read, it is never held in memory as a whole.
+/// @param file_name The city list.
+/// @param table Receives the cities, unchanged if the import fails.
+/// @return false if the file could not be read or parsed.
+bool import_city_list(const std::string& file_name, CityTable& table);
+
+/// Loads the city catalog. The catalog file is mapped if it is at least as new as the city list. Otherwise the city
+/// list is imported and saved as catalog file for the next start.
+/// @param city_list The OpenWeatherMap city list, may be empty to only use the catalog file.
+/// @param catalog_file The catalog file, may be empty to always import the city list.
+/// @param table Receives the cities.
+/// @return false if no cities could be loaded.
+bool load_cities(const std::string& city_list, const std::string& catalog_file, CityTable& table);
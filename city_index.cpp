@@ -0,0 +1,115 @@
+#include "city_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace
+{
+const double earth_radius = 6371.0088; // mean radius in km
+const double radians = M_PI / 180;
+}
+
+
+void CityIndex::build(const CityTable& table)
+{
+  nodes_.clear();
+  nodes_.reserve(table.size());
+  by_latitude_.clear();
+  by_latitude_.reserve(table.size());
+  for (const auto& city : table) {
+    nodes_.push_back({point(city.latitude_, city.longitude_), &city});
+    by_latitude_.push_back(&city);
+  }
+
+  build(0, nodes_.size(), 0);
+  std::sort(by_latitude_.begin(), by_latitude_.end(),
+    [](const City* a, const City* b) { return a->latitude_ < b->latitude_; });
+}
+
+
+const City* CityIndex::nearest(double latitude, double longitude, double& distance) const
+{
+  if (nodes_.empty()) {
+    return nullptr;
+  }
+
+  size_t best = 0;
+  float best_distance = std::numeric_limits<float>::max();
+  search(0, nodes_.size(), 0, point(latitude, longitude), best, best_distance);
+
+  // The squared chord length between the unit vectors gives the central angle.
+  double chord = std::sqrt(static_cast<double>(best_distance));
+  distance = 2 * earth_radius * std::asin(std::min(1.0, chord / 2));
+  return nodes_[best].city_;
+}
+
+
+void CityIndex::within(double south, double west, double north, double east, std::vector<const City*>& cities) const
+{
+  auto it = std::lower_bound(by_latitude_.begin(), by_latitude_.end(), south,
+    [](const City* city, double value) { return city->latitude_ < value; });
+  for (; it != by_latitude_.end() && (*it)->latitude_ <= north; ++it) {
+    double longitude = (*it)->longitude_;
+    if (west <= east ? (longitude >= west && longitude <= east) : (longitude >= west || longitude <= east)) {
+      cities.push_back(*it);
+    }
+  }
+}
+
+
+CityIndex::Point CityIndex::point(double latitude, double longitude)
+{
+  double phi = latitude * radians;
+  double lambda = longitude * radians;
+  return {static_cast<float>(std::cos(phi) * std::cos(lambda)), static_cast<float>(std::cos(phi) * std::sin(lambda)),
+    static_cast<float>(std::sin(phi))};
+}
+
+
+void CityIndex::build(size_t begin, size_t end, int axis)
+{
+  if (end - begin <= 1) {
+    return;
+  }
+  size_t middle = begin + (end - begin) / 2;
+  std::nth_element(nodes_.begin() + begin, nodes_.begin() + middle, nodes_.begin() + end,
+    [axis](const Node& a, const Node& b) { return a.point_[axis] < b.point_[axis]; });
+  build(begin, middle, (axis + 1) % 3);
+  build(middle + 1, end, (axis + 1) % 3);
+}
+
+
+void CityIndex::search(
+  size_t begin, size_t end, int axis, const Point& target, size_t& best, float& best_distance) const
+{
+  if (begin >= end) {
+    return;
+  }
+  size_t middle = begin + (end - begin) / 2;
+  const auto& p = nodes_[middle].point_;
+
+  float dx = p.x_ - target.x_;
+  float dy = p.y_ - target.y_;
+  float dz = p.z_ - target.z_;
+  float distance = dx * dx + dy * dy + dz * dz;
+  if (distance < best_distance) {
+    best_distance = distance;
+    best = middle;
+  }
+
+  float split = target[axis] - p[axis];
+  int next = (axis + 1) % 3;
+  if (split < 0) {
+    search(begin, middle, next, target, best, best_distance);
+    if (split * split < best_distance) {
+      search(middle + 1, end, next, target, best, best_distance);
+    }
+  } else {
+    search(middle + 1, end, next, target, best, best_distance);
+    if (split * split < best_distance) {
+      search(begin, middle, next, target, best, best_distance);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+/// @file city_index.h
+
+#pragma once
+
+#include "city_catalog.h"
+
+#include <cstdint>
+#include <vector>
+
+
+/// @brief Spatial index over the cities of a CityTable.
+/// Nearest city lookups use a k-d tree over the cities' positions as unit vectors, so distances are exact on the
+/// sphere, also across the antimeridian and near the poles. Bounding box lookups use the cities sorted by latitude.
+/// The index refers to the records of the table, it has to be rebuilt when the table changes.
+class CityIndex
+{
+public:
+  /// Builds the index.
+  /// @param table The cities to index.
+  void build(const CityTable& table);
+
+  /// Returns the city nearest to a position.
+  /// @param latitude Latitude in degrees.
+  /// @param longitude Longitude in degrees.
+  /// @param distance Receives the great circle distance in km.
+  /// @return The nearest city or nullptr if the index is empty.
+  const City* nearest(double latitude, double longitude, double& distance) const;
+
+  /// Returns the cities inside a bounding box. A box with west > east crosses the antimeridian.
+  /// @param south Southern latitude in degrees.
+  /// @param west Western longitude in degrees.
+  /// @param north Northern latitude in degrees.
+  /// @param east Eastern longitude in degrees.
+  /// @param cities Receives the cities, sorted by latitude.
+  void within(double south, double west, double north, double east, std::vector<const City*>& cities) const;
+
+  /// Returns the number of indexed cities.
+  /// @return The number of cities.
+  size_t size() const
+  {
+    return nodes_.size();
+  }
+
+private:
+  struct Point
+  {
+    float x_, y_, z_;
+
+    float operator[](int axis) const
+    {
+      return axis == 0 ? x_ : axis == 1 ? y_ : z_;
+    }
+  };
+
+  struct Node
+  {
+    Point point_;
+    const City* city_;
+  };
+
+  static Point point(double latitude, double longitude);
+  void build(size_t begin, size_t end, int axis);
+  void search(size_t begin, size_t end, int axis, const Point& target, size_t& best, float& best_distance) const;
+
+  std::vector<Node> nodes_; ///< Implicit k-d tree, the median of every range is its root.
+  std::vector<const City*> by_latitude_;
+};
@@ -0,0 +1,142 @@
+#include "endpoint.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+
+namespace
+{
+const char* const api = "https://api.openweathermap.org/data/2.5/";
+
+void replace(std::string& text, const std::string& placeholder, const std::string& value)
+{
+  for (size_t pos = text.find(placeholder); pos != std::string::npos; pos = text.find(placeholder, pos + value.size())) {
+    text.replace(pos, placeholder.size(), value);
+  }
+}
+
+std::string coordinate(double value)
+{
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.4f", value);
+  return text;
+}
+
+/// The forecast parser of the thread, it keeps its buffers between responses.
+ForecastParser& forecast_parser()
+{
+  thread_local ForecastParser parser;
+  return parser;
+}
+}
+
+
+Endpoint::Endpoint(std::string name, std::string url_template, std::chrono::seconds interval)
+  : name_(std::move(name)), url_template_(std::move(url_template)), interval_(interval)
+{
+}
+
+
+std::string Endpoint::url(const Location& location, const std::string& api_key) const
+{
+  std::string url = url_template_;
+  replace(url, "{query}", location.query_);
+  replace(url, "{lat}", coordinate(location.latitude_));
+  replace(url, "{lon}", coordinate(location.longitude_));
+  replace(url, "{key}", api_key);
+  return url;
+}
+
+
+WeatherEndpoint::WeatherEndpoint(std::chrono::seconds interval)
+  : Endpoint("weather", std::string(api) + "weather?{query}&APPID={key}", interval)
+{
+}
+
+
+bool WeatherEndpoint::process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink)
+{
+  Observation observation;
+  observation.path_ = location.path_;
+  observation.fetched_ = fetched;
+  if (!parse_observation(body, observation)) {
+    return false;
+  }
+  if (sink.publish(observation)) {
+    sink.received(location, body, observation.observed_ ? observation.observed_ : fetched);
+  }
+  return true;
+}
+
+
+ForecastEndpoint::ForecastEndpoint(std::chrono::seconds interval)
+  : Endpoint("forecast", std::string(api) + "forecast?{query}&APPID={key}", interval)
+{
+}
+
+
+void ForecastEndpoint::set_parallel(ParallelFor parallel_for, IdleThreads idle, size_t split_bytes)
+{
+  parallel_for_ = std::move(parallel_for);
+  idle_ = std::move(idle);
+  split_bytes_ = split_bytes;
+}
+
+
+bool ForecastEndpoint::process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink)
+{
+  thread_local Forecast forecast;
+  auto& parser = forecast_parser();
+
+  size_t parts = parallel_for_ && split_bytes_ > 0 && body.size() >= 2 * split_bytes_
+    ? std::min(idle_() + 1, body.size() / split_bytes_)
+    : 0;
+  ForecastLayout layout;
+  if (parts > 1 && ForecastParser::scan(body.c_str(), layout)) {
+    // The steps are parsed in parts of consecutive steps, each by the parser of the thread running the part.
+    if (!parser.parse_header(body.c_str(), layout, forecast)) {
+      return false;
+    }
+    parts = std::min(parts, layout.count_);
+    std::atomic<bool> valid{true};
+    // forecast is thread local, the parts run on other threads have to fill the instance of this one.
+    auto* steps = &forecast;
+    parallel_for_(parts, [&body, &layout, &valid, steps, parts](size_t part) {
+      auto& step_parser = forecast_parser();
+      for (size_t i = layout.count_ * part / parts; i < layout.count_ * (part + 1) / parts; ++i) {
+        if (!step_parser.parse_step(body.c_str(), layout, i, *steps)) {
+          valid = false;
+        }
+      }
+    });
+    if (!valid) {
+      return false;
+    }
+  } else if (!parser.parse(body.c_str(), forecast)) {
+    return false;
+  }
+  forecast.fetched_ = fetched;
+  sink.publish(location, forecast);
+  return true;
+}
+
+
+AirPollutionEndpoint::AirPollutionEndpoint(std::chrono::seconds interval)
+  : Endpoint("air_pollution", std::string(api) + "air_pollution?lat={lat}&lon={lon}&APPID={key}", interval)
+{
+}
+
+
+bool AirPollutionEndpoint::process(
+  const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink)
+{
+  Observation observation;
+  observation.path_ = value_path(location.path_, "air");
+  observation.fetched_ = fetched;
+  if (!parse_air_pollution(body, observation)) {
+    return false;
+  }
+  sink.publish(observation);
+  return true;
+}
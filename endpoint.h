@@ -0,0 +1,149 @@
+/// @file endpoint.h
+
+#pragma once
+
+#include "forecast.h"
+#include "location.h"
+#include "observation.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+/// @brief Receives what the endpoints parsed from their responses. Implemented by the link, which publishes it.
+class EndpointSink
+{
+public:
+  virtual ~EndpointSink() = default;
+
+  /// Called with the raw current weather response of a location after its observation has been published.
+  /// @param location The location.
+  /// @param body The response body.
+  /// @param observed Observation time of the response in ms since the epoch.
+  virtual void received(const Location& location, const std::string& body, int64_t observed) = 0;
+
+  /// Publishes the values of an observation below its path, stamped with its observation time.
+  /// @param observation The observation.
+  /// @return false if the observation time has not advanced since the last observation of the path, nothing was
+  /// published then.
+  virtual bool publish(const Observation& observation) = 0;
+
+  /// Publishes the forecast of a location.
+  /// @param location The location.
+  /// @param forecast The forecast.
+  virtual void publish(const Location& location, const Forecast& forecast) = 0;
+};
+
+
+/// @brief An API endpoint which is polled for every location.
+/// An endpoint declares its URL template, parses its responses with its own SAX handler and maps the result to nodes
+/// by handing it to the EndpointSink. Fetching, rate limiting and scheduling are shared by all endpoints. The polls of
+/// one endpoint never overlap, but the responses of one poll are processed by several parse workers at once, so parse
+/// state an endpoint keeps between responses has to be per thread.
+class Endpoint
+{
+public:
+  /// Constructs an endpoint.
+  /// @param name Name of the endpoint, used in log messages.
+  /// @param url_template URL of the endpoint. {query}, {lat}, {lon} and {key} are replaced by the location query, the
+  /// coordinates of the location and the API key.
+  /// @param interval Delay between two polls.
+  Endpoint(std::string name, std::string url_template, std::chrono::seconds interval);
+  virtual ~Endpoint() = default;
+
+  /// Returns the name of the endpoint.
+  /// @return The name.
+  const std::string& name() const
+  {
+    return name_;
+  }
+
+  /// Returns the delay between two polls.
+  /// @return The delay.
+  std::chrono::seconds interval() const
+  {
+    return interval_;
+  }
+
+  /// Returns the URL to poll for a location.
+  /// @param location The location.
+  /// @param api_key The OpenWeatherMap API key.
+  /// @return The URL.
+  std::string url(const Location& location, const std::string& api_key) const;
+
+  /// Returns when the endpoint was last polled for each location, indexed like the configured locations.
+  /// @return The poll times.
+  std::vector<std::chrono::steady_clock::time_point>& polled()
+  {
+    return polled_;
+  }
+
+  /// Parses a response and hands the result to the sink.
+  /// @param location The location the response belongs to.
+  /// @param body The response body.
+  /// @param fetched Time the response was received in ms since the epoch.
+  /// @param sink Receives the parsed result.
+  /// @return false if the response could not be parsed.
+  virtual bool process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink) = 0;
+
+private:
+  std::string name_;
+  std::string url_template_;
+  std::chrono::seconds interval_;
+  std::vector<std::chrono::steady_clock::time_point> polled_;
+};
+
+
+/// The current weather (/data/2.5/weather), published as value nodes of the location.
+class WeatherEndpoint : public Endpoint
+{
+public:
+  /// Constructs the endpoint.
+  /// @param interval Delay between two polls.
+  explicit WeatherEndpoint(std::chrono::seconds interval);
+
+  bool process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink) override;
+};
+
+
+/// The 5 day / 3 hour forecast (/data/2.5/forecast), published as forecast table of the location.
+class ForecastEndpoint : public Endpoint
+{
+public:
+  /// Runs body(0) to body(count - 1), possibly in parallel, and returns when all of them have finished.
+  using ParallelFor = std::function<void(size_t count, const std::function<void(size_t)>& body)>;
+  /// Returns the number of threads which are free to run parts right away.
+  using IdleThreads = std::function<size_t()>;
+
+  /// Constructs the endpoint.
+  /// @param interval Delay between two polls.
+  explicit ForecastEndpoint(std::chrono::seconds interval);
+
+  /// Lets large responses be split at their forecast steps, the parts are parsed with parallel_for. Finding the steps
+  /// costs about a third of a parse, so a response is only split into as many parts as there are idle threads.
+  /// @param parallel_for Runs the parts, e.g. ParsePool::parallel_for.
+  /// @param idle Returns the number of idle threads besides the calling one, e.g. ParsePool::idle.
+  /// @param split_bytes Minimum size of a part, 0 never splits.
+  void set_parallel(ParallelFor parallel_for, IdleThreads idle, size_t split_bytes);
+
+  bool process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink) override;
+
+private:
+  ParallelFor parallel_for_;
+  IdleThreads idle_;
+  size_t split_bytes_{0};
+};
+
+
+/// The air pollution (/data/2.5/air_pollution), published as value nodes below `air` of the location.
+class AirPollutionEndpoint : public Endpoint
+{
+public:
+  /// Constructs the endpoint.
+  /// @param interval Delay between two polls.
+  explicit AirPollutionEndpoint(std::chrono::seconds interval);
+
+  bool process(const Location& location, const std::string& body, int64_t fetched, EndpointSink& sink) override;
+};
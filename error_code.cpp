@@ -35,6 +35,38 @@ public:
         return "Text value set to";
       case responder_error_code::curl_error:
         return "CURL";
+      case responder_error_code::config_error:
+        return "Could not load configuration";
+      case responder_error_code::history_query:
+        return "Invalid history query";
+      case responder_error_code::history_segment:
+        return "History segment";
+      case responder_error_code::history_restored:
+        return "Restored history blocks";
+      case responder_error_code::snapshot_error:
+        return "Snapshot";
+      case responder_error_code::snapshot_restored:
+        return "Restored observations from snapshot";
+      case responder_error_code::city_catalog_error:
+        return "City catalog";
+      case responder_error_code::city_catalog_loaded:
+        return "Loaded city catalog";
+      case responder_error_code::city_query:
+        return "Invalid city query";
+      case responder_error_code::endpoint_error:
+        return "Endpoint";
+      case responder_error_code::publish_error:
+        return "Publish";
+      case responder_error_code::trace_error:
+        return "Trace";
+      case responder_error_code::recording_error:
+        return "Recording";
+      case responder_error_code::pipeline_error:
+        return "Pipeline";
+      case responder_error_code::spill_error:
+        return "Spill";
+      case responder_error_code::spill_replayed:
+        return "Replayed observations from spill";
     }
 
     return "<Unknown error>";
@@ -17,7 +17,23 @@ enum class responder_error_code
   subscribed_text,
   unsubscribed_text,
   set_text,
-  curl_error
+  curl_error,
+  config_error,
+  history_query,
+  history_segment,
+  history_restored,
+  snapshot_error,
+  snapshot_restored,
+  city_catalog_error,
+  city_catalog_loaded,
+  city_query,
+  endpoint_error,
+  publish_error,
+  trace_error,
+  recording_error,
+  pipeline_error,
+  spill_error,
+  spill_replayed
 };
 
 
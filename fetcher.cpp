@@ -0,0 +1,267 @@
+#include "fetcher.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <thread>
+
+
+struct Fetcher::Handle
+{
+  CURL* curl_{nullptr};
+  char error_[CURL_ERROR_SIZE];
+  CURLcode result_{CURLE_OK};
+  bool done_{false}; ///< Set by the thread of the multi handle when the request is complete.
+
+  ~Handle()
+  {
+    if (curl_) {
+      curl_easy_cleanup(curl_);
+    }
+  }
+};
+
+
+namespace
+{
+size_t writer(char* data, size_t size, size_t nmemb, std::string* body)
+{
+  body->append(data, size * nmemb);
+  return size * nmemb;
+}
+
+int64_t microseconds(CURL* curl, CURLINFO info)
+{
+  // The double variants are also available with older libcurl versions than the curl_off_t ones.
+  double seconds = 0;
+  curl_easy_getinfo(curl, info, &seconds);
+  return static_cast<int64_t>(seconds * 1e6);
+}
+
+CURLM* as_multi(void* multi)
+{
+  return static_cast<CURLM*>(multi);
+}
+}
+
+
+Fetcher::Fetcher(unsigned requests_per_minute, long max_connections, long max_streams,
+  std::chrono::seconds connect_timeout, std::chrono::seconds timeout)
+  : rate_(requests_per_minute / 60000.0)
+  , capacity_(requests_per_minute)
+  , tokens_(requests_per_minute)
+  , refilled_(std::chrono::steady_clock::now())
+  , connect_timeout_(static_cast<long>(connect_timeout.count()))
+  , timeout_(static_cast<long>(timeout.count()))
+  , multi_(curl_multi_init())
+{
+  CURLM* multi = as_multi(multi_);
+  if (!multi) {
+    return;
+  }
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  if (max_connections > 0) {
+    // All requests go to the same host, so the host limit is the total one as well. Requests beyond it wait for a
+    // connection inside curl.
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_connections);
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_connections);
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, max_connections);
+  }
+#if LIBCURL_VERSION_NUM >= 0x074300
+  if (max_streams > 0) {
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, max_streams);
+  }
+#else
+  (void)max_streams;
+#endif
+  thread_ = std::thread([this]() { run(); });
+}
+
+
+Fetcher::~Fetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+#if LIBCURL_VERSION_NUM >= 0x074400
+  curl_multi_wakeup(as_multi(multi_));
+#endif
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  // The easy handles have to be cleaned up before the multi handle which holds their connections.
+  idle_.clear();
+  if (multi_) {
+    curl_multi_cleanup(as_multi(multi_));
+  }
+}
+
+
+bool Fetcher::get(const std::string& url, std::string& body, std::string& error, Timing& timing)
+{
+  auto handle = multi_ ? acquire() : nullptr;
+  if (!handle) {
+    error = "Failed to create CURL connection";
+    return false;
+  }
+
+  throttle();
+
+  CURL* curl = handle->curl_;
+  handle->error_[0] = '\0';
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, handle->error_);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writer);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // Waits for a stream on a connection which is being established instead of opening one more.
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, handle.get());
+  // A stalled connection would hold every request multiplexed on it, they fail with CURLE_OPERATION_TIMEDOUT instead.
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout_);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout_);
+
+  CURLcode code;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      error = "Fetcher stopped";
+      return false;
+    }
+    handle->done_ = false;
+    pending_.push_back(handle.get());
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(as_multi(multi_));
+#endif
+    completed_.wait(lock, [&handle]() { return handle->done_; });
+    code = handle->result_;
+  }
+  long status = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  timing.dns_ = microseconds(curl, CURLINFO_NAMELOOKUP_TIME);
+  timing.connect_ = microseconds(curl, CURLINFO_CONNECT_TIME);
+  timing.tls_ = microseconds(curl, CURLINFO_APPCONNECT_TIME);
+  timing.first_byte_ = microseconds(curl, CURLINFO_STARTTRANSFER_TIME);
+  timing.total_ = microseconds(curl, CURLINFO_TOTAL_TIME);
+
+  bool ok = code == CURLE_OK && status == 200;
+  if (code != CURLE_OK) {
+    error = handle->error_[0] ? handle->error_ : curl_easy_strerror(code);
+  } else if (status != 200) {
+    error = "HTTP status " + std::to_string(status);
+  }
+
+  release(std::move(handle));
+  return ok;
+}
+
+
+void Fetcher::run()
+{
+  CURLM* multi = as_multi(multi_);
+  std::vector<Handle*> added;
+  for (;;) {
+    int running = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) {
+        break;
+      }
+      for (auto* handle : pending_) {
+        curl_multi_add_handle(multi, handle->curl_);
+        added.push_back(handle);
+      }
+      pending_.clear();
+    }
+
+    curl_multi_perform(multi, &running);
+    int queued;
+    bool completed = false;
+    while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+      if (message->msg != CURLMSG_DONE) continue;
+      Handle* handle = nullptr;
+      curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &handle);
+      CURLcode result = message->data.result;
+      curl_multi_remove_handle(multi, message->easy_handle);
+      added.erase(std::find(added.begin(), added.end(), handle));
+      std::lock_guard<std::mutex> lock(mutex_);
+      handle->result_ = result;
+      handle->done_ = true;
+      completed = true;
+    }
+    if (completed) {
+      completed_.notify_all();
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+    // Woken up by get() when a request is pending.
+    curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+    // Without curl_multi_wakeup() a new request waits for the timeout at most.
+    curl_multi_wait(multi, nullptr, 0, 50, nullptr);
+#endif
+  }
+
+  // Fails the requests which did not complete, their threads are waiting for them.
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto* handle : added) {
+    curl_multi_remove_handle(multi, handle->curl_);
+    pending_.push_back(handle);
+  }
+  for (auto* handle : pending_) {
+    handle->result_ = CURLE_ABORTED_BY_CALLBACK;
+    handle->done_ = true;
+  }
+  pending_.clear();
+  completed_.notify_all();
+}
+
+
+std::unique_ptr<Fetcher::Handle> Fetcher::acquire()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      auto handle = std::move(idle_.back());
+      idle_.pop_back();
+      return handle;
+    }
+  }
+
+  std::unique_ptr<Handle> handle{new Handle};
+  handle->curl_ = curl_easy_init();
+  return handle->curl_ ? std::move(handle) : nullptr;
+}
+
+
+void Fetcher::release(std::unique_ptr<Handle> handle)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.push_back(std::move(handle));
+}
+
+
+void Fetcher::throttle()
+{
+  if (rate_ <= 0) {
+    return;
+  }
+
+  double wait;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(now - refilled_).count();
+    refilled_ = now;
+    tokens_ = std::min(capacity_, tokens_ + elapsed * rate_);
+    // Taking the token before waiting for it keeps the requests of all threads in order.
+    tokens_ -= 1;
+    wait = tokens_ < 0 ? -tokens_ / rate_ : 0;
+  }
+  if (wait > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+  }
+}
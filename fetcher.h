@@ -0,0 +1,82 @@
+/// @file fetcher.h
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// @brief HTTP client shared by all endpoints.
+/// The requests of all threads run on one curl multi handle, driven by a thread of its own. HTTPS requests negotiate
+/// HTTP/2 and wait for a stream on an existing connection rather than opening another one, so the concurrent requests
+/// to the API are multiplexed over a few kept alive connections; servers without HTTP/2 get HTTP/1.1 on up to the
+/// connection limit. All requests share one rate limit, a token bucket which allows a burst of one minute's worth of
+/// requests. Thread safe.
+class Fetcher
+{
+public:
+  /// Durations of the phases of a request in µs, each from the start of the request. A phase which did not take place,
+  /// e.g. the TLS handshake of a plain HTTP request or the connect of a reused connection, is 0.
+  struct Timing
+  {
+    int64_t dns_{0};        ///< Until the name was resolved.
+    int64_t connect_{0};    ///< Until the connection was established.
+    int64_t tls_{0};        ///< Until the TLS handshake was done.
+    int64_t first_byte_{0}; ///< Until the first byte of the response was received.
+    int64_t total_{0};      ///< Until the request was complete.
+  };
+
+  /// Constructs a fetcher and starts its thread.
+  /// @param requests_per_minute The rate limit, 0 for none.
+  /// @param max_connections Maximum number of connections to a host, 0 for no limit.
+  /// @param max_streams Maximum number of concurrent requests on an HTTP/2 connection, 0 for the server's limit.
+  /// @param connect_timeout Maximum time to establish a connection, 0 for no limit.
+  /// @param timeout Maximum time of a request, including the time it waits for a connection, 0 for no limit.
+  Fetcher(unsigned requests_per_minute, long max_connections, long max_streams, std::chrono::seconds connect_timeout,
+    std::chrono::seconds timeout);
+
+  /// Stops the thread, requests which are still running fail.
+  ~Fetcher();
+
+  Fetcher(const Fetcher&) = delete;
+  Fetcher& operator=(const Fetcher&) = delete;
+
+  /// Performs a GET request. Blocks until the rate limit allows the request and until it is complete or timed out.
+  /// @param url The URL to get.
+  /// @param body Receives the response body, appended to the current content.
+  /// @param error Receives the reason if the request failed.
+  /// @param timing Receives the durations of the phases of the request.
+  /// @return false if the request failed or the response status is not 200.
+  bool get(const std::string& url, std::string& body, std::string& error, Timing& timing);
+
+private:
+  struct Handle;
+
+  std::unique_ptr<Handle> acquire();
+  void release(std::unique_ptr<Handle> handle);
+  void throttle();
+  void run();
+
+  std::mutex mutex_; ///< Guards idle_, the rate limit, pending_, stopping_ and the results of the handles.
+  std::vector<std::unique_ptr<Handle>> idle_;
+
+  double rate_;     ///< Tokens per ms.
+  double capacity_; ///< Maximum tokens.
+  double tokens_;
+  std::chrono::steady_clock::time_point refilled_;
+
+  const long connect_timeout_; ///< In s.
+  const long timeout_;         ///< In s.
+
+  void* multi_;                   ///< The CURLM handle, only used by thread_ apart from the wakeup.
+  std::vector<Handle*> pending_;  ///< Requests to add to the multi handle.
+  std::condition_variable completed_;
+  bool stopping_{false};
+  std::thread thread_;
+};
@@ -0,0 +1,534 @@
+#include "forecast.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace rapidjson;
+
+
+namespace
+{
+/// SAX handler for a forecast response:
+/// {"list": [{"dt": 1551204000, "main": {"temp": 281.5, ...}, "weather": [{"description": "light rain", ...}],
+///            "clouds": {"all": 92}, "wind": {"speed": 4.1, "deg": 250}, "pop": 0.4, "rain": {"3h": 0.3}}, ...],
+///  "city": {"id": 2643743, ...}}
+/// Keys are resolved to a Field while their string is valid, the nesting is tracked in a fixed size stack.
+class ForecastHandler : public BaseReaderHandler<UTF8<>, ForecastHandler>
+{
+public:
+  explicit ForecastHandler(Forecast& forecast)
+    : forecast_(forecast)
+  {
+  }
+
+  /// Constructs a handler for a single step of the list, which is parsed into forecast.entries_[index].
+  ForecastHandler(Forecast& forecast, size_t index)
+    : forecast_(forecast), step_(&forecast.entries_[index])
+  {
+    stack_[0] = Root;
+    stack_[1] = List;
+    depth_ = 2;
+  }
+
+  /// Returns whether the step of a single step handler has been parsed.
+  bool step_parsed() const
+  {
+    return step_ == nullptr;
+  }
+
+  bool StartObject()
+  {
+    Context context = Ignored;
+    switch (top()) {
+      case None:
+        context = Root;
+        break;
+      case Root:
+        context = key_ == City ? CityObject : Ignored;
+        break;
+      case List:
+        context = Entry;
+        entry_ = nullptr;
+        if (step_) {
+          entry_ = step_;
+          step_ = nullptr;
+        } else if (forecast_.count_ < Forecast::max_entries) {
+          entry_ = &forecast_.entries_[forecast_.count_++];
+        }
+        if (entry_) {
+          std::memset(entry_, 0, sizeof(*entry_));
+        }
+        break;
+      case Entry:
+        context = key_ == Main ? MainObject
+                  : key_ == Clouds ? CloudsObject
+                  : key_ == Wind ? WindObject
+                  : key_ == Rain || key_ == Snow ? PrecipitationObject
+                  : Ignored;
+        break;
+      case Weather:
+        context = WeatherItem;
+        break;
+      default:
+        break;
+    }
+    return push(context);
+  }
+
+  bool EndObject(SizeType)
+  {
+    return pop();
+  }
+
+  bool StartArray()
+  {
+    Context context = Ignored;
+    if (top() == Root && key_ == ListArray) {
+      context = List;
+    } else if (top() == Entry && key_ == WeatherArray) {
+      context = Weather;
+    }
+    return push(context);
+  }
+
+  bool EndArray(SizeType)
+  {
+    return pop();
+  }
+
+  bool Key(const Ch* str, SizeType length, bool)
+  {
+    // Keys have to match in length, so only the keys of the same length are compared.
+    key_ = Other;
+    switch (length) {
+      case 2:
+        key_ = match(str, "dt") ? Dt : match(str, "id") ? Id : match(str, "3h") ? ThreeHours : Other;
+        break;
+      case 3:
+        key_ = match(str, "pop") ? Pop : match(str, "all") ? All : match(str, "deg") ? Deg : Other;
+        break;
+      case 4:
+        key_ = match(str, "list") ? ListArray
+               : match(str, "city") ? City
+               : match(str, "main") ? Main
+               : match(str, "wind") ? Wind
+               : match(str, "rain") ? Rain
+               : match(str, "snow") ? Snow
+               : match(str, "temp") ? Temp
+               : Other;
+        break;
+      case 5:
+        key_ = match(str, "speed") ? Speed : Other;
+        break;
+      case 6:
+        key_ = match(str, "clouds") ? Clouds : Other;
+        break;
+      case 7:
+        key_ = match(str, "weather") ? WeatherArray : Other;
+        break;
+      case 8:
+        key_ = match(str, "temp_min") ? TempMin
+               : match(str, "temp_max") ? TempMax
+               : match(str, "pressure") ? Pressure
+               : match(str, "humidity") ? Humidity
+               : Other;
+        break;
+      case 10:
+        key_ = match(str, "feels_like") ? FeelsLike : Other;
+        break;
+      case 11:
+        key_ = match(str, "description") ? Description : Other;
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  bool String(const Ch* str, SizeType length, bool)
+  {
+    if (top() == WeatherItem && key_ == Description && entry_ && entry_->description_[0] == '\0') {
+      size_t size = std::min<size_t>(length, sizeof(entry_->description_) - 1);
+      std::memcpy(entry_->description_, str, size);
+      entry_->description_[size] = '\0';
+    }
+    return true;
+  }
+
+  bool Int(int i)
+  {
+    return number(i);
+  }
+  bool Uint(unsigned u)
+  {
+    return number(u);
+  }
+  bool Int64(int64_t i)
+  {
+    return number(static_cast<double>(i));
+  }
+  bool Uint64(uint64_t u)
+  {
+    return number(static_cast<double>(u));
+  }
+  bool Double(double d)
+  {
+    return number(d);
+  }
+
+  bool Default()
+  {
+    return true;
+  }
+
+private:
+  enum Context : uint8_t
+  {
+    None,
+    Root,
+    List,
+    Entry,
+    MainObject,
+    Weather,
+    WeatherItem,
+    CloudsObject,
+    WindObject,
+    PrecipitationObject,
+    CityObject,
+    Ignored
+  };
+
+  enum Field : uint8_t
+  {
+    Other,
+    ListArray,
+    City,
+    Id,
+    Dt,
+    Main,
+    WeatherArray,
+    Clouds,
+    Wind,
+    Rain,
+    Snow,
+    Pop,
+    Temp,
+    FeelsLike,
+    TempMin,
+    TempMax,
+    Pressure,
+    Humidity,
+    All,
+    Speed,
+    Deg,
+    ThreeHours,
+    Description
+  };
+
+  template <size_t size>
+  static bool match(const Ch* str, const char (&key)[size])
+  {
+    return std::memcmp(str, key, size - 1) == 0;
+  }
+
+  Context top() const
+  {
+    return depth_ == 0 ? None : stack_[depth_ - 1];
+  }
+
+  bool push(Context context)
+  {
+    if (depth_ == sizeof(stack_)) {
+      return false; // nested deeper than any forecast response
+    }
+    stack_[depth_++] = context;
+    key_ = Other;
+    return true;
+  }
+
+  bool pop()
+  {
+    --depth_;
+    key_ = Other;
+    return true;
+  }
+
+  bool number(double value)
+  {
+    Context context = top();
+    if (context == CityObject && key_ == Id) {
+      forecast_.city_id_ = static_cast<uint32_t>(value);
+    }
+    if (!entry_) {
+      return true;
+    }
+
+    float v = static_cast<float>(value);
+    switch (context) {
+      case Entry:
+        if (key_ == Dt) {
+          entry_->timestamp_ = static_cast<int64_t>(value) * 1000;
+        } else if (key_ == Pop) {
+          entry_->precipitation_probability_ = v;
+        }
+        break;
+      case MainObject:
+        switch (key_) {
+          case Temp:
+            entry_->temperature_ = v;
+            break;
+          case FeelsLike:
+            entry_->feels_like_ = v;
+            break;
+          case TempMin:
+            entry_->temperature_min_ = v;
+            break;
+          case TempMax:
+            entry_->temperature_max_ = v;
+            break;
+          case Pressure:
+            entry_->pressure_ = v;
+            break;
+          case Humidity:
+            entry_->humidity_ = v;
+            break;
+          default:
+            break;
+        }
+        break;
+      case CloudsObject:
+        if (key_ == All) {
+          entry_->clouds_ = v;
+        }
+        break;
+      case WindObject:
+        if (key_ == Speed) {
+          entry_->wind_speed_ = v;
+        } else if (key_ == Deg) {
+          entry_->wind_direction_ = v;
+        }
+        break;
+      case PrecipitationObject:
+        if (key_ == ThreeHours) {
+          entry_->precipitation_ += v;
+        }
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  Forecast& forecast_;
+  ForecastEntry* step_{nullptr}; ///< The step a single step handler parses into, until it started.
+  ForecastEntry* entry_{nullptr};
+  Context stack_[16];
+  size_t depth_{0};
+  Field key_{Other};
+};
+
+
+/// Input stream over a scanned response which jumps from the '[' of the list to its ']', so the parser sees the
+/// response without its steps and the header is parsed in place.
+class HeaderStream
+{
+public:
+  typedef char Ch;
+
+  HeaderStream(const char* json, const ForecastLayout& layout)
+    : begin_(json), position_(json), gap_(json + layout.list_begin_ + 1), resume_(json + layout.list_end_)
+  {
+  }
+
+  Ch Peek() const
+  {
+    return *position_;
+  }
+
+  Ch Take()
+  {
+    Ch c = *position_++;
+    if (position_ == gap_) {
+      position_ = resume_;
+    }
+    return c;
+  }
+
+  size_t Tell() const
+  {
+    return static_cast<size_t>(position_ - begin_);
+  }
+
+  // Only needed for in situ parsing.
+  Ch* PutBegin()
+  {
+    RAPIDJSON_ASSERT(false);
+    return nullptr;
+  }
+  void Put(Ch)
+  {
+    RAPIDJSON_ASSERT(false);
+  }
+  void Flush()
+  {
+    RAPIDJSON_ASSERT(false);
+  }
+  size_t PutEnd(Ch*)
+  {
+    RAPIDJSON_ASSERT(false);
+    return 0;
+  }
+
+private:
+  const char* begin_;
+  const char* position_;
+  const char* gap_;    ///< Just after the '[' of the list.
+  const char* resume_; ///< The ']' of the list.
+};
+}
+
+
+bool ForecastParser::parse(const char* json, Forecast& forecast)
+{
+  forecast.city_id_ = 0;
+  forecast.count_ = 0;
+
+  ForecastHandler handler(forecast);
+  StringStream stream(json);
+  return !reader_.Parse(stream, handler).IsError() && forecast.count_ > 0;
+}
+
+
+bool ForecastParser::scan(const char* json, ForecastLayout& layout)
+{
+  layout.list_begin_ = 0;
+  layout.list_end_ = 0;
+  layout.count_ = 0;
+
+  auto add_step = [json, &layout](const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+      ++p;
+    }
+    if (*p != ']' && layout.count_ < Forecast::max_entries) {
+      layout.steps_[layout.count_++] = p - json;
+    }
+  };
+
+  // The characters the scan stops at, it only tracks the structure: the nesting depth, the keys of the root object and
+  // the separators of the list.
+  static const struct Structural
+  {
+    bool flags_[256];
+    Structural()
+      : flags_()
+    {
+      for (unsigned char c : {'\0', '"', '{', '}', '[', ']', ','}) {
+        flags_[c] = true;
+      }
+    }
+    bool operator[](unsigned char c) const
+    {
+      return flags_[c];
+    }
+  } structural;
+
+  int depth = 0;
+  bool key = false;      // the next string at depth 1 is a key
+  bool list_key = false; // the last key at depth 1 is "list"
+  bool in_list = false;
+  for (const char* p = json;; ++p) {
+    while (!structural[static_cast<unsigned char>(*p)]) {
+      ++p;
+    }
+    switch (*p) {
+      case '\0':
+        return false;
+      case '"': {
+        const char* begin = ++p;
+        // A backslash escapes the next character, so the string ends at the first quote which is not skipped.
+        while (*p != '"') {
+          if (*p == '\0' || (*p == '\\' && *++p == '\0')) {
+            return false;
+          }
+          ++p;
+        }
+        if (depth == 1 && key) {
+          list_key = p - begin == 4 && std::memcmp(begin, "list", 4) == 0;
+          key = false;
+        }
+        break;
+      }
+      case '{':
+      case '[':
+        ++depth;
+        if (depth == 1) {
+          key = true;
+        } else if (depth == 2 && *p == '[' && list_key && layout.list_begin_ == 0) {
+          in_list = true;
+          layout.list_begin_ = p - json;
+          add_step(p + 1);
+        }
+        break;
+      case '}':
+      case ']':
+        if (in_list && depth == 2) {
+          layout.list_end_ = p - json;
+          return layout.count_ > 0;
+        }
+        if (--depth == 0) {
+          return false;
+        }
+        break;
+      case ',':
+        if (depth == 1) {
+          key = true;
+          list_key = false;
+        } else if (in_list && depth == 2) {
+          add_step(p + 1);
+        }
+        break;
+    }
+  }
+}
+
+
+bool ForecastParser::parse_header(const char* json, const ForecastLayout& layout, Forecast& forecast)
+{
+  forecast.city_id_ = 0;
+  forecast.count_ = 0;
+
+  ForecastHandler handler(forecast);
+  HeaderStream stream(json, layout);
+  if (reader_.Parse(stream, handler).IsError()) {
+    return false;
+  }
+  forecast.count_ = layout.count_;
+  return true;
+}
+
+
+bool ForecastParser::parse_step(const char* json, const ForecastLayout& layout, size_t index, Forecast& forecast)
+{
+  ForecastHandler handler(forecast, index);
+  StringStream stream(json + layout.steps_[index]);
+  return !reader_.Parse<kParseStopWhenDoneFlag>(stream, handler).IsError() && handler.step_parsed();
+}
+
+
+void ForecastStore::update(const std::string& path, const Forecast& forecast)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  forecasts_[path] = forecast;
+}
+
+
+bool ForecastStore::get(const std::string& path, Forecast& forecast) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = forecasts_.find(path);
+  if (it == forecasts_.end()) {
+    return false;
+  }
+  forecast = it->second;
+  return true;
+}
@@ -0,0 +1,112 @@
+/// @file forecast.h
+
+#pragma once
+
+#include "rapidjson/reader.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+
+/// One 3 hour step of the 5 day forecast.
+struct ForecastEntry
+{
+  int64_t timestamp_;                ///< Start of the forecast step in ms since the epoch.
+  float temperature_;                ///< Temperature in K.
+  float feels_like_;                 ///< Perceived temperature in K.
+  float temperature_min_;            ///< Minimum temperature in K.
+  float temperature_max_;            ///< Maximum temperature in K.
+  float pressure_;                   ///< Atmospheric pressure in hPa.
+  float humidity_;                   ///< Humidity in %.
+  float clouds_;                     ///< Cloudiness in %.
+  float wind_speed_;                 ///< Wind speed in m/s.
+  float wind_direction_;             ///< Wind direction in degrees.
+  float precipitation_probability_; ///< Probability of precipitation, 0 to 1.
+  float precipitation_;              ///< Rain and snow volume of the step in mm.
+  char description_[32];             ///< Weather condition, zero terminated and truncated if longer.
+};
+
+
+/// The 5 day / 3 hour forecast of one location. Fixed size, so it can be reused and copied without allocating.
+struct Forecast
+{
+  static const size_t max_entries = 40; ///< The API returns at most 5 days of 3 hour steps.
+
+  int64_t fetched_{0};                  ///< Time the forecast was fetched in ms since the epoch.
+  uint32_t city_id_{0};                 ///< OpenWeatherMap city id of the forecast.
+  size_t count_{0};                     ///< Number of valid entries.
+  ForecastEntry entries_[max_entries]; ///< The forecast steps, oldest first.
+};
+
+
+/// Where the steps of a forecast response are, found by ForecastParser::scan() without parsing the values.
+struct ForecastLayout
+{
+  size_t list_begin_;                   ///< Offset of the '[' of the list.
+  size_t list_end_;                     ///< Offset of the ']' of the list.
+  size_t count_;                        ///< Number of steps, at most Forecast::max_entries.
+  size_t steps_[Forecast::max_entries]; ///< Offsets of the steps.
+};
+
+
+/// @brief SAX parser for responses of the forecast API (/data/2.5/forecast).
+/// The parser fills a caller provided Forecast and keeps its parse stack between calls, so once it has parsed the first
+/// response no memory is allocated. Not thread safe, use one parser per thread.
+class ForecastParser
+{
+public:
+  /// Parses a forecast response.
+  /// @param json The response body, zero terminated.
+  /// @param forecast Receives the forecast, entries beyond Forecast::max_entries are dropped.
+  /// @return false if the response is not valid JSON or contains no forecast steps.
+  bool parse(const char* json, Forecast& forecast);
+
+  /// Finds the steps of a forecast response, so they can be parsed separately, e.g. by several threads. The values are
+  /// not validated, a response which scans fine can still fail to parse.
+  /// @param json The response body, zero terminated.
+  /// @param layout Receives the offsets.
+  /// @return false if the response has no non-empty list of steps.
+  static bool scan(const char* json, ForecastLayout& layout);
+
+  /// Parses everything but the steps of a scanned response, i.e. the city, and sets the step count. The steps are
+  /// skipped in place, nothing is copied.
+  /// @param json The response body, zero terminated.
+  /// @param layout The layout found by scan().
+  /// @param forecast Receives the city and the step count.
+  /// @return false if the response is not valid JSON.
+  bool parse_header(const char* json, const ForecastLayout& layout, Forecast& forecast);
+
+  /// Parses one step of a scanned response.
+  /// @param json The response body, zero terminated.
+  /// @param layout The layout found by scan().
+  /// @param index Index of the step.
+  /// @param forecast Receives the step in forecast.entries_[index].
+  /// @return false if the step is not a valid JSON object.
+  bool parse_step(const char* json, const ForecastLayout& layout, size_t index, Forecast& forecast);
+
+private:
+  rapidjson::Reader reader_;
+};
+
+
+/// @brief The latest forecast of every location.
+class ForecastStore
+{
+public:
+  /// Replaces the forecast of a location.
+  /// @param path The node path of the location.
+  /// @param forecast The new forecast.
+  void update(const std::string& path, const Forecast& forecast);
+
+  /// Returns the forecast of a location.
+  /// @param path The node path of the location.
+  /// @param forecast Receives a copy of the forecast.
+  /// @return false if there is no forecast for the location yet.
+  bool get(const std::string& path, Forecast& forecast) const;
+
+private:
+  mutable std::mutex mutex_;
+  std::map<std::string, Forecast> forecasts_;
+};
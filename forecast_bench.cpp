@@ -0,0 +1,101 @@
+#include "forecast.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+using namespace std;
+
+
+// Counts the heap allocations, the parse path must not allocate once the parser is warm.
+static atomic<size_t> allocations{0};
+
+void* operator new(size_t size)
+{
+  ++allocations;
+  if (void* p = malloc(size)) {
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+
+// A forecast response in the layout of /data/2.5/forecast, 40 steps of 3 hours.
+static string make_response()
+{
+  const int64_t start = 1551204000;
+  string json = "{\"cod\":\"200\",\"message\":0.0036,\"cnt\":40,\"list\":[";
+  char entry[1024];
+  for (int i = 0; i < 40; ++i) {
+    snprintf(entry, sizeof(entry),
+      "%s{\"dt\":%lld,\"main\":{\"temp\":%.2f,\"feels_like\":%.2f,\"temp_min\":%.2f,\"temp_max\":%.2f,"
+      "\"pressure\":%d,\"sea_level\":%d,\"grnd_level\":%d,\"humidity\":%d,\"temp_kf\":0.64},"
+      "\"weather\":[{\"id\":500,\"main\":\"Rain\",\"description\":\"light rain\",\"icon\":\"10d\"}],"
+      "\"clouds\":{\"all\":%d},\"wind\":{\"speed\":%.2f,\"deg\":%d,\"gust\":%.2f},\"visibility\":10000,"
+      "\"pop\":%.2f,\"rain\":{\"3h\":%.2f},\"sys\":{\"pod\":\"d\"},\"dt_txt\":\"2019-02-26 18:00:00\"}",
+      i ? "," : "", static_cast<long long>(start + i * 3 * 3600), 281.5 + i * 0.1, 279.1 + i * 0.1, 280.9, 282.3,
+      1021 + i % 5, 1021, 1018, 80 - i % 10, 40 + i % 50, 4.1 + i * 0.05, 200 + i, 7.3, 0.2 + (i % 8) * 0.1,
+      0.1 * (i % 4));
+    json += entry;
+  }
+  json += "],\"city\":{\"id\":2643743,\"name\":\"London\",\"coord\":{\"lat\":51.5085,\"lon\":-0.1257},"
+          "\"country\":\"GB\",\"population\":1000000,\"timezone\":0,\"sunrise\":1551163406,\"sunset\":1551202542}}";
+  return json;
+}
+
+
+int main()
+{
+  string json = make_response();
+  ForecastParser parser;
+  Forecast forecast;
+  if (!parser.parse(json.c_str(), forecast)) {
+    printf("parse failed\n");
+    return EXIT_FAILURE;
+  }
+
+  const int rounds = 20000;
+  size_t before = allocations;
+  auto begin = chrono::steady_clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    parser.parse(json.c_str(), forecast);
+  }
+  auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+  size_t allocated = allocations - before;
+
+  printf("forecast   %5zu bytes %2zu steps %7.1f us/parse %6.0f MB/s %zu allocations in %d parses\n", json.size(),
+    forecast.count_, double(elapsed) / rounds / 1000, double(json.size()) * rounds * 1000 / elapsed, allocated,
+    rounds);
+  printf("first step %s %.2f K, %s, city %u\n", json.substr(json.find("\"dt\":") + 5, 10).c_str(),
+    forecast.entries_[0].temperature_, forecast.entries_[0].description_, forecast.city_id_);
+
+  // The path of the parse stage for a response split into parts: scan, header, then every step.
+  ForecastLayout layout;
+  Forecast split;
+  size_t split_before = allocations;
+  begin = chrono::steady_clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    if (!ForecastParser::scan(json.c_str(), layout) || !parser.parse_header(json.c_str(), layout, split)) {
+      printf("split parse failed\n");
+      return EXIT_FAILURE;
+    }
+    for (size_t step = 0; step < layout.count_; ++step) {
+      parser.parse_step(json.c_str(), layout, step, split);
+    }
+  }
+  elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+  size_t split_allocated = allocations - split_before;
+
+  printf("split      %5zu bytes %2zu steps %7.1f us/parse %6.0f MB/s %zu allocations in %d parses, city %u\n",
+    json.size(), split.count_, double(elapsed) / rounds / 1000, double(json.size()) * rounds * 1000 / elapsed,
+    split_allocated, rounds, split.city_id_);
+  return allocated == 0 && split_allocated == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
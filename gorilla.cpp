@@ -0,0 +1,255 @@
+#include "gorilla.h"
+#include "checksum.h"
+
+#include <cstring>
+
+
+namespace
+{
+/// Upper bound of bits a single sample can take, used to decide if a block is full.
+const size_t max_sample_bits = 5 + 64 + 2 + 5 + 6 + 64;
+
+/// Payload widths of the delta-of-delta buckets, indexed by the number of leading one bits of the bucket prefix.
+const unsigned dod_bits[] = {0, 7, 9, 12, 20, 64};
+
+inline uint64_t mask(unsigned bits)
+{
+  return bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1;
+}
+
+inline bool fits(int64_t value, unsigned bits)
+{
+  return value >= -(int64_t{1} << (bits - 1)) && value < (int64_t{1} << (bits - 1));
+}
+
+inline uint64_t to_bits(double value)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline double from_bits(uint64_t bits)
+{
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+}
+
+
+constexpr size_t GorillaBlockData::size_bytes;
+constexpr size_t GorillaBlock::size_bytes;
+
+
+GorillaBlock::GorillaBlock()
+  : heap_(new GorillaBlockData)
+  , data_(heap_.get())
+{
+  data_->count_.store(0, std::memory_order_relaxed);
+  data_->used_bits_.store(0, std::memory_order_relaxed);
+  data_->checksum_.store(0, std::memory_order_relaxed);
+  data_->reserved_ = 0;
+  data_->first_timestamp_.store(0, std::memory_order_relaxed);
+  data_->last_timestamp_.store(0, std::memory_order_relaxed);
+  for (auto& word : data_->words_) {
+    word.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+GorillaBlock::GorillaBlock(GorillaBlockData* data, std::shared_ptr<const void> owner, bool writable)
+  : owner_(std::move(owner))
+  , data_(data)
+  , writable_(writable)
+  , validity_(writable ? 1 : 0)
+{
+}
+
+
+bool GorillaBlock::append(int64_t timestamp, double value)
+{
+  if (!writable_) {
+    return false;
+  }
+
+  uint32_t count = data_->count_.load(std::memory_order_relaxed);
+  uint64_t bits = to_bits(value);
+
+  if (count == 0) {
+    write_bits(static_cast<uint64_t>(timestamp), 64);
+    write_bits(bits, 64);
+    data_->first_timestamp_.store(timestamp, std::memory_order_relaxed);
+  } else {
+    if (bit_pos_ + max_sample_bits > size_bytes * 8) {
+      return false;
+    }
+
+    int64_t delta = timestamp - prev_timestamp_;
+    int64_t dod = delta - prev_delta_;
+    if (dod == 0) {
+      write_bits(0, 1);
+    } else {
+      unsigned ones = 1;
+      while (ones < 5 && !fits(dod, dod_bits[ones])) {
+        ++ones;
+      }
+      if (ones < 5) {
+        write_bits(mask(ones) << 1, ones + 1);
+      } else {
+        write_bits(mask(5), 5);
+      }
+      write_bits(static_cast<uint64_t>(dod) & mask(dod_bits[ones]), dod_bits[ones]);
+    }
+    prev_delta_ = delta;
+
+    uint64_t xored = bits ^ prev_value_;
+    if (xored == 0) {
+      write_bits(0, 1);
+    } else {
+      unsigned leading = static_cast<unsigned>(__builtin_clzll(xored));
+      unsigned trailing = static_cast<unsigned>(__builtin_ctzll(xored));
+      if (leading > 31) {
+        leading = 31;
+      }
+
+      if (leading >= prev_leading_ && trailing >= prev_trailing_) {
+        write_bits(0x2, 2);
+        write_bits(xored >> prev_trailing_, 64 - prev_leading_ - prev_trailing_);
+      } else {
+        unsigned meaningful = 64 - leading - trailing;
+        write_bits(0x3, 2);
+        write_bits(leading, 5);
+        write_bits(meaningful - 1, 6);
+        write_bits(xored >> trailing, meaningful);
+        prev_leading_ = leading;
+        prev_trailing_ = trailing;
+      }
+    }
+  }
+
+  prev_timestamp_ = timestamp;
+  prev_value_ = bits;
+  data_->last_timestamp_.store(timestamp, std::memory_order_relaxed);
+  data_->used_bits_.store(static_cast<uint32_t>(bit_pos_), std::memory_order_relaxed);
+  // Words before the current bit position never change again.
+  size_t complete = bit_pos_ / 64;
+  if (complete > crc_words_) {
+    words_crc_ = crc32(data_->words_ + crc_words_, (complete - crc_words_) * sizeof(uint64_t), words_crc_);
+    crc_words_ = complete;
+  }
+  data_->checksum_.store(compute_checksum(words_crc_, crc_words_, count + 1), std::memory_order_relaxed);
+  data_->count_.store(count + 1, std::memory_order_release);
+  return true;
+}
+
+
+bool GorillaBlock::valid() const
+{
+  int validity = validity_.load(std::memory_order_acquire);
+  if (validity == 0) {
+    bool matches = count() > 0 && used_bits() <= size_bytes * 8 &&
+                   compute_checksum(0, 0, count()) == data_->checksum_.load(std::memory_order_relaxed);
+    validity = matches ? 1 : -1;
+    validity_.store(validity, std::memory_order_release);
+  }
+  return validity > 0;
+}
+
+
+uint32_t GorillaBlock::compute_checksum(uint32_t words_crc, size_t from_word, uint32_t count) const
+{
+  struct
+  {
+    uint32_t count_;
+    uint32_t used_bits_;
+    int64_t first_timestamp_;
+    int64_t last_timestamp_;
+  } header = {count, data_->used_bits_.load(std::memory_order_relaxed),
+    data_->first_timestamp_.load(std::memory_order_relaxed), data_->last_timestamp_.load(std::memory_order_relaxed)};
+
+  size_t used_words = (header.used_bits_ + 63) / 64;
+  uint32_t crc = crc32(data_->words_ + from_word, (used_words - from_word) * sizeof(uint64_t), words_crc);
+  return crc32(&header, sizeof(header), crc);
+}
+
+
+void GorillaBlock::write_bits(uint64_t value, unsigned bits)
+{
+  while (bits > 0) {
+    unsigned room = 64 - bit_pos_ % 64;
+    unsigned take = bits < room ? bits : room;
+    uint64_t chunk = (value >> (bits - take)) & mask(take);
+
+    auto& word = data_->words_[bit_pos_ / 64];
+    word.store(word.load(std::memory_order_relaxed) | (chunk << (room - take)), std::memory_order_relaxed);
+
+    bits -= take;
+    bit_pos_ += take;
+  }
+}
+
+
+GorillaReader::GorillaReader(const GorillaBlock& block)
+  : data_(block.data())
+  , remaining_(block.count())
+{
+}
+
+
+bool GorillaReader::next(Sample& sample)
+{
+  if (remaining_ == 0) {
+    return false;
+  }
+  --remaining_;
+
+  if (index_++ == 0) {
+    timestamp_ = static_cast<int64_t>(read_bits(64));
+    value_ = read_bits(64);
+    leading_ = 64;
+  } else {
+    unsigned ones = 0;
+    while (ones < 5 && read_bits(1)) {
+      ++ones;
+    }
+    if (ones > 0) {
+      unsigned width = dod_bits[ones];
+      uint64_t raw = read_bits(width);
+      int64_t dod = width < 64 && (raw >> (width - 1)) ? static_cast<int64_t>(raw | ~mask(width))
+                                                      : static_cast<int64_t>(raw);
+      delta_ += dod;
+    }
+    timestamp_ += delta_;
+
+    if (read_bits(1)) {
+      if (read_bits(1)) {
+        leading_ = static_cast<unsigned>(read_bits(5));
+        unsigned meaningful = static_cast<unsigned>(read_bits(6)) + 1;
+        trailing_ = 64 - leading_ - meaningful;
+      }
+      value_ ^= read_bits(64 - leading_ - trailing_) << trailing_;
+    }
+  }
+
+  sample.timestamp_ = timestamp_;
+  sample.value_ = from_bits(value_);
+  return true;
+}
+
+
+uint64_t GorillaReader::read_bits(unsigned bits)
+{
+  uint64_t result = 0;
+  while (bits > 0) {
+    unsigned room = 64 - bit_pos_ % 64;
+    unsigned take = bits < room ? bits : room;
+    uint64_t word = data_.words_[bit_pos_ / 64].load(std::memory_order_relaxed);
+
+    result = (result << (take % 64)) | ((word >> (room - take)) & mask(take));
+
+    bits -= take;
+    bit_pos_ += take;
+  }
+  return result;
+}
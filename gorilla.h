@@ -0,0 +1,158 @@
+/// @file gorilla.h
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+/// One observation of a metric. The timestamp is given in milliseconds since the epoch.
+struct Sample
+{
+  int64_t timestamp_; ///< Observation time in ms since the epoch.
+  double value_;      ///< Observed value.
+};
+
+
+/// @brief The storage of a GorillaBlock.
+/// The layout is fixed, so it can live on the heap as well as inside a memory mapped history segment. A zero filled
+/// instance is an empty block.
+struct GorillaBlockData
+{
+  /// Size of the encoded data of a block in bytes.
+  static constexpr size_t size_bytes = 512;
+
+  std::atomic<uint32_t> count_;           ///< Number of published samples.
+  std::atomic<uint32_t> used_bits_;       ///< Number of bits used by the published samples.
+  std::atomic<uint32_t> checksum_;        ///< CRC-32 of the used words followed by the other header fields.
+  uint32_t reserved_;                     ///< Padding, always 0.
+  std::atomic<int64_t> first_timestamp_;  ///< Timestamp of the first sample.
+  std::atomic<int64_t> last_timestamp_;   ///< Timestamp of the last published sample.
+  std::atomic<uint64_t> words_[size_bytes / sizeof(uint64_t)]; ///< The encoded samples, most significant bit first.
+};
+
+
+/// @brief Fixed size block of samples compressed like Facebook's Gorilla TSDB.
+/// Timestamps are stored as delta-of-delta with variable length buckets and values as XOR against the previous value,
+/// only keeping the meaningful bits. Regularly polled weather data mostly costs one or two bits per sample.
+///
+/// There must only be one writer, readers may decode the block concurrently while it is appended to. Bits are only
+/// ever added to the storage words, so every bit a reader decodes is already final once it saw the sample count.
+/// Every append also updates the checksum, so a block found in a history segment after a crash can be validated. The
+/// checksum covers the words before the header fields, so the CRC of the completed words is carried over from append
+/// to append and only the last word and the header are added each time.
+class GorillaBlock
+{
+public:
+  /// Size of the encoded data of a block in bytes.
+  static constexpr size_t size_bytes = GorillaBlockData::size_bytes;
+
+  /// Constructs an empty block with its storage on the heap.
+  GorillaBlock();
+
+  /// Constructs a block on external storage.
+  /// @param data The storage, either zero filled or holding a previously written block.
+  /// @param owner Keeps the storage alive as long as the block exists.
+  /// @param writable If false, the block is a read-only view of a previously written block. Its checksum will be
+  /// validated before it is decoded the first time.
+  GorillaBlock(GorillaBlockData* data, std::shared_ptr<const void> owner, bool writable);
+
+  /// Appends a sample. Must only be called by the writer thread. The timestamps have to be ascending.
+  /// @param timestamp Observation time in ms since the epoch.
+  /// @param value The observed value.
+  /// @return false if the block is full or read-only, the sample was not added.
+  bool append(int64_t timestamp, double value);
+
+  /// Checks if the block content matches its checksum. Only blocks loaded from external storage are actually
+  /// checked, the result is cached.
+  /// @return true if the block can be decoded.
+  bool valid() const;
+
+  /// Returns the number of samples readers may decode.
+  /// @return The sample count.
+  uint32_t count() const
+  {
+    return data_->count_.load(std::memory_order_acquire);
+  }
+
+  /// Returns the timestamp of the first sample, only valid if count() > 0.
+  /// @return The first timestamp.
+  int64_t first_timestamp() const
+  {
+    return data_->first_timestamp_.load(std::memory_order_relaxed);
+  }
+
+  /// Returns the timestamp of the last published sample, only valid if count() > 0.
+  /// @return The last timestamp.
+  int64_t last_timestamp() const
+  {
+    return data_->last_timestamp_.load(std::memory_order_acquire);
+  }
+
+  /// Returns the number of bits used by the published samples.
+  /// @return The used bits.
+  size_t used_bits() const
+  {
+    return data_->used_bits_.load(std::memory_order_relaxed);
+  }
+
+  /// Returns the storage of this block.
+  /// @return The block storage.
+  const GorillaBlockData& data() const
+  {
+    return *data_;
+  }
+
+private:
+  friend class GorillaReader;
+
+  void write_bits(uint64_t value, unsigned bits);
+  uint32_t compute_checksum(uint32_t words_crc, size_t from_word, uint32_t count) const;
+
+  std::unique_ptr<GorillaBlockData> heap_;
+  std::shared_ptr<const void> owner_;
+  GorillaBlockData* data_;
+  bool writable_{true};
+  mutable std::atomic<int> validity_{1}; ///< 1 valid, 0 not checked yet, -1 corrupt.
+
+  // Encoder state, only touched by the writer.
+  size_t bit_pos_{0};
+  int64_t prev_timestamp_{0};
+  int64_t prev_delta_{0};
+  uint64_t prev_value_{0};
+  unsigned prev_leading_{64};
+  unsigned prev_trailing_{0};
+  uint32_t words_crc_{0};  ///< CRC-32 of the completed words.
+  size_t crc_words_{0};    ///< Number of words covered by words_crc_.
+};
+
+
+/// @brief Sequential decoder for a GorillaBlock.
+/// Decodes the samples which were published when the reader was constructed.
+class GorillaReader
+{
+public:
+  /// Constructs a reader positioned before the first sample.
+  /// @param block The block to decode.
+  explicit GorillaReader(const GorillaBlock& block);
+
+  /// Decodes the next sample.
+  /// @param sample Receives the sample.
+  /// @return false if all samples have been read.
+  bool next(Sample& sample);
+
+private:
+  uint64_t read_bits(unsigned bits);
+
+  const GorillaBlockData& data_;
+  uint32_t remaining_;
+  uint32_t index_{0};
+  size_t bit_pos_{0};
+  int64_t timestamp_{0};
+  int64_t delta_{0};
+  uint64_t value_{0};
+  unsigned leading_{0};
+  unsigned trailing_{0};
+};
@@ -0,0 +1,96 @@
+#include "gzip_stream.h"
+
+#include <cstring>
+
+
+GzipReadStream::GzipReadStream(std::FILE* file, size_t buffer_size)
+  : file_(file)
+  , input_(buffer_size)
+  , output_(buffer_size + 1)
+  , current_(output_.data())
+  , end_(output_.data())
+{
+  std::memset(&zstream_, 0, sizeof(zstream_));
+
+  read_input();
+  gzip_ = zstream_.avail_in >= 2 && zstream_.next_in[0] == 0x1f && zstream_.next_in[1] == 0x8b;
+  // 16 + MAX_WBITS makes zlib expect a gzip header and trailer.
+  if (gzip_ && inflateInit2(&zstream_, 16 + MAX_WBITS) != Z_OK) {
+    gzip_ = false;
+    failed_ = true;
+  }
+  fill();
+}
+
+
+GzipReadStream::~GzipReadStream()
+{
+  if (gzip_) {
+    inflateEnd(&zstream_);
+  }
+}
+
+
+size_t GzipReadStream::read_input()
+{
+  if (zstream_.avail_in == 0 && !input_eof_) {
+    size_t read = std::fread(input_.data(), 1, input_.size(), file_);
+    if (read == 0) {
+      input_eof_ = true;
+      failed_ = failed_ || std::ferror(file_);
+    }
+    zstream_.next_in = reinterpret_cast<Bytef*>(input_.data());
+    zstream_.avail_in = static_cast<uInt>(read);
+  }
+  return zstream_.avail_in;
+}
+
+
+void GzipReadStream::fill()
+{
+  count_ += static_cast<size_t>(end_ - output_.data());
+  Ch* out = output_.data();
+  size_t size = output_.size() - 1;
+  size_t produced = 0;
+
+  if (!failed_ && !gzip_) {
+    produced = read_input();
+    std::memcpy(out, zstream_.next_in, produced);
+    zstream_.avail_in = 0;
+  }
+
+  while (!failed_ && gzip_ && produced == 0) {
+    read_input();
+    if (member_end_) {
+      // A gzip file may consist of several members, anything after the first one is another member.
+      if (zstream_.avail_in == 0) {
+        break;
+      }
+      inflateReset(&zstream_);
+      member_end_ = false;
+    }
+    if (zstream_.avail_in == 0) {
+      failed_ = true; // truncated
+      break;
+    }
+
+    zstream_.next_out = reinterpret_cast<Bytef*>(out);
+    zstream_.avail_out = static_cast<uInt>(size);
+    int result = inflate(&zstream_, Z_NO_FLUSH);
+    produced = size - zstream_.avail_out;
+    if (result == Z_STREAM_END) {
+      member_end_ = true;
+    } else if ((result != Z_OK && result != Z_BUF_ERROR) || (result == Z_BUF_ERROR && produced == 0)) {
+      failed_ = true;
+    }
+  }
+
+  current_ = out;
+  if (produced == 0) {
+    eof_ = true;
+    out[0] = '\0';
+    end_ = out;
+  } else {
+    end_ = out + produced;
+  }
+}
@@ -0,0 +1,87 @@
+/// @file gzip_stream.h
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+#include <zlib.h>
+
+
+/// @brief rapidjson input stream which inflates a gzip file while it is read.
+/// Only one input and one output buffer are held, so memory use does not depend on the size of the file. Files which
+/// do not start with the gzip magic are read as they are. Implements the rapidjson Stream concept for reading.
+class GzipReadStream
+{
+public:
+  typedef char Ch;
+
+  /// Constructs a stream.
+  /// @param file The file to read from, opened for reading in binary mode. It is not closed by the stream.
+  /// @param buffer_size Size of the input and the output buffer.
+  explicit GzipReadStream(std::FILE* file, size_t buffer_size = 64 * 1024);
+  ~GzipReadStream();
+
+  GzipReadStream(const GzipReadStream&) = delete;
+  GzipReadStream& operator=(const GzipReadStream&) = delete;
+
+  Ch Peek() const
+  {
+    return *current_;
+  }
+
+  Ch Take()
+  {
+    Ch c = *current_;
+    if (!eof_ && ++current_ == end_) {
+      fill();
+    }
+    return c;
+  }
+
+  size_t Tell() const
+  {
+    return count_ + static_cast<size_t>(current_ - output_.data());
+  }
+
+  // Not implemented
+  void Put(Ch)
+  {
+  }
+  void Flush()
+  {
+  }
+  Ch* PutBegin()
+  {
+    return nullptr;
+  }
+  size_t PutEnd(Ch*)
+  {
+    return 0;
+  }
+
+  /// Returns if the file could not be read or is not a valid or complete gzip file.
+  /// @return true if reading failed, the stream then ends early.
+  bool failed() const
+  {
+    return failed_;
+  }
+
+private:
+  void fill();
+  size_t read_input();
+
+  std::FILE* file_;
+  std::vector<Ch> input_;
+  std::vector<Ch> output_;
+  const Ch* current_;
+  const Ch* end_;
+  size_t count_{0};
+  bool eof_{false};
+  bool failed_{false};
+
+  z_stream zstream_;
+  bool gzip_{false};
+  bool input_eof_{false};
+  bool member_end_{false};
+};
@@ -0,0 +1,82 @@
+#include "histogram.h"
+
+
+Histogram::Histogram()
+{
+  for (auto& count : buckets_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+void Histogram::record(int64_t value)
+{
+  if (value < 0) {
+    value = 0;
+  } else if (value >= (int64_t(1) << max_bits)) {
+    value = (int64_t(1) << max_bits) - 1;
+  }
+
+  buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  total_.fetch_add(1, std::memory_order_relaxed);
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+
+Histogram::Summary Histogram::collect()
+{
+  uint64_t counts[bucket_count];
+  Summary summary;
+  for (int i = 0; i < bucket_count; ++i) {
+    counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+    summary.count_ += counts[i];
+  }
+  summary.max_ = max_.exchange(0, std::memory_order_relaxed);
+  if (summary.count_ == 0) {
+    return summary;
+  }
+
+  // Ranks of the percentiles, rounded up, so p99 of 10 values is the largest one.
+  const uint64_t ranks[] = {(summary.count_ * 50 + 99) / 100, (summary.count_ * 95 + 99) / 100,
+                            (summary.count_ * 99 + 99) / 100};
+  int64_t* values[] = {&summary.p50_, &summary.p95_, &summary.p99_};
+  uint64_t seen = 0;
+  int next = 0;
+  for (int i = 0; i < bucket_count && next < 3; ++i) {
+    seen += counts[i];
+    while (next < 3 && seen >= ranks[next]) {
+      *values[next++] = upper_bound(i);
+    }
+  }
+
+  // The maximum is exact, a bucket bound above it would overstate the percentiles.
+  for (auto* value : values) {
+    if (*value > summary.max_) {
+      *value = summary.max_;
+    }
+  }
+  return summary;
+}
+
+
+int Histogram::bucket(int64_t value)
+{
+  if (value < sub_buckets) {
+    return static_cast<int>(value);
+  }
+  int shift = 63 - __builtin_clzll(static_cast<uint64_t>(value)) - sub_bits;
+  return (shift + 1) * sub_buckets + static_cast<int>((value >> shift) - sub_buckets);
+}
+
+
+int64_t Histogram::upper_bound(int bucket)
+{
+  if (bucket < sub_buckets) {
+    return bucket;
+  }
+  int shift = bucket / sub_buckets - 1;
+  int64_t mantissa = bucket % sub_buckets + sub_buckets;
+  return ((mantissa + 1) << shift) - 1;
+}
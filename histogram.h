@@ -0,0 +1,59 @@
+/// @file histogram.h
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+
+/// @brief Lock-free histogram with HDR-style log-linear buckets.
+/// Every power of two range is split into 32 linear sub buckets, so a recorded value is reported with an error of at
+/// most 1/32 (about 3%). Values up to 2^40 are kept. Recording is a few relaxed atomic increments, so it can be called
+/// from any thread on hot paths. collect() summarizes and resets the values recorded since its last call.
+class Histogram
+{
+public:
+  /// Summary of the values recorded in an interval.
+  struct Summary
+  {
+    uint64_t count_{0}; ///< Number of values.
+    int64_t p50_{0};    ///< Median, as upper bound of its bucket.
+    int64_t p95_{0};    ///< 95th percentile, as upper bound of its bucket.
+    int64_t p99_{0};    ///< 99th percentile, as upper bound of its bucket.
+    int64_t max_{0};    ///< Exact maximum.
+  };
+
+  Histogram();
+
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  /// Records a value. Negative values are recorded as 0, values above the range as its maximum.
+  /// @param value The value.
+  void record(int64_t value);
+
+  /// Summarizes the values recorded since the last call and resets the histogram. Values recorded concurrently are
+  /// either part of this or of the next summary.
+  /// @return The summary.
+  Summary collect();
+
+  /// Returns the total number of values recorded, it is not reset by collect().
+  /// @return The number of values.
+  uint64_t total() const
+  {
+    return total_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static const int sub_bits = 5;
+  static const int sub_buckets = 1 << sub_bits;
+  static const int max_bits = 40;
+  static const int bucket_count = (max_bits - sub_bits + 1) * sub_buckets;
+
+  static int bucket(int64_t value);
+  static int64_t upper_bound(int bucket);
+
+  std::atomic<uint64_t> buckets_[bucket_count];
+  std::atomic<int64_t> max_{0};
+  std::atomic<uint64_t> total_{0};
+};
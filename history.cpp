@@ -0,0 +1,348 @@
+#include "history.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+
+HistorySeries::HistorySeries(const std::string& path, int64_t retention, BlockStorage* storage)
+  : path_(path)
+  , retention_(retention)
+  , storage_(storage)
+  , blocks_(std::make_shared<Blocks>())
+{
+}
+
+
+void HistorySeries::restore(std::shared_ptr<GorillaBlock> block)
+{
+  auto current = std::atomic_load(&blocks_);
+  auto next = std::make_shared<Blocks>(*current);
+  auto position = next->begin();
+  while (position != next->end() && (*position)->first_timestamp() < block->first_timestamp()) {
+    ++position;
+  }
+  // A timestamp from the future would make every append fail until it is reached, the clock is the newest valid one.
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t last = std::min(block->last_timestamp(), now);
+  if (last > last_timestamp_) {
+    last_timestamp_ = last;
+  }
+  next->insert(position, std::move(block));
+  std::atomic_store(&blocks_, std::shared_ptr<const Blocks>(std::move(next)));
+}
+
+
+bool HistorySeries::append(int64_t timestamp, double value)
+{
+  if (timestamp <= last_timestamp_) {
+    return false;
+  }
+
+  if (!open_ || !open_->append(timestamp, value)) {
+    if (open_ && storage_) {
+      storage_->seal(*open_);
+    }
+    open_ = storage_ ? storage_->allocate(path_, timestamp) : nullptr;
+    if (!open_) {
+      open_ = std::make_shared<GorillaBlock>();
+    }
+    open_->append(timestamp, value);
+
+    auto current = std::atomic_load(&blocks_);
+    auto next = std::make_shared<Blocks>();
+    next->reserve(current->size() + 1);
+    for (const auto& block : *current) {
+      if (block->last_timestamp() >= timestamp - retention_) {
+        next->push_back(block);
+      }
+    }
+    next->push_back(open_);
+    std::atomic_store(&blocks_, std::shared_ptr<const Blocks>(std::move(next)));
+  }
+
+  last_timestamp_ = timestamp;
+  return true;
+}
+
+
+size_t HistorySeries::read(int64_t from, int64_t to, std::vector<Sample>& out) const
+{
+  auto blocks = std::atomic_load(&blocks_);
+
+  size_t first = out.size();
+  for (const auto& block : *blocks) {
+    if (block->count() == 0 || block->last_timestamp() < from || block->first_timestamp() > to || !block->valid()) {
+      continue;
+    }
+    GorillaReader reader(*block);
+    Sample sample;
+    while (reader.next(sample)) {
+      if (sample.timestamp_ > to) {
+        break;
+      }
+      if (sample.timestamp_ >= from) {
+        out.push_back(sample);
+      }
+    }
+  }
+
+  return out.size() - first;
+}
+
+
+int64_t HistorySeries::first_timestamp() const
+{
+  auto blocks = std::atomic_load(&blocks_);
+  for (const auto& block : *blocks) {
+    if (block->count() > 0 && block->valid()) {
+      return block->first_timestamp();
+    }
+  }
+  return 0;
+}
+
+
+int64_t HistorySeries::last_timestamp() const
+{
+  auto blocks = std::atomic_load(&blocks_);
+  return blocks->empty() ? 0 : blocks->back()->last_timestamp();
+}
+
+
+size_t HistorySeries::memory_usage() const
+{
+  auto blocks = std::atomic_load(&blocks_);
+  return blocks->size() * (sizeof(GorillaBlock) + sizeof(GorillaBlockData));
+}
+
+
+HistoryStore::HistoryStore(int64_t retention, std::shared_ptr<BlockStorage> storage)
+  : retention_(retention)
+  , storage_(std::move(storage))
+{
+}
+
+
+void HistoryStore::restore(const std::string& path, std::shared_ptr<GorillaBlock> block)
+{
+  series(path).restore(std::move(block));
+}
+
+
+void HistoryStore::append(const std::string& path, int64_t timestamp, double value)
+{
+  HistorySeries* raw;
+  std::vector<RollupSeries>* rollups;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    raw = &series_locked(path);
+    auto it = rollups_.find(path);
+    if (it == rollups_.end()) {
+      it = rollups_.insert(std::make_pair(path, std::vector<RollupSeries>{})).first;
+      for (const auto& level : rollup_levels) {
+        HistorySeries* fields[RollupSeries::FieldCount];
+        for (int field = 0; field < RollupSeries::FieldCount; ++field) {
+          fields[field] = &series_locked(RollupSeries::key(path, level, static_cast<RollupSeries::Field>(field)));
+        }
+        it->second.emplace_back(level, fields);
+      }
+    }
+    rollups = &it->second;
+  }
+
+  if (raw->append(timestamp, value)) {
+    for (auto& rollup : *rollups) {
+      rollup.add(timestamp, value, *raw);
+    }
+  }
+}
+
+
+size_t HistoryStore::query(
+  const std::string& path,
+  int64_t from,
+  int64_t to,
+  int resolution,
+  std::vector<HistoryRow>& rows) const
+{
+  const HistorySeries* raw = find(path);
+  if (!raw) {
+    return 0;
+  }
+
+  if (resolution == auto_resolution) {
+    // Assume a sample per minute, the rollups only make sense for slower polling anyway. An open range, e.g. from
+    // the minimum of int64_t for an empty Timerange, spans the retained samples only.
+    int64_t extent_from = std::max(from, raw->first_timestamp());
+    int64_t extent_to = std::min(to, raw->last_timestamp());
+    int64_t span = extent_to > extent_from ? extent_to - extent_from : 0;
+    resolution = raw_resolution;
+    if (span / (60 * 1000) > max_points) {
+      for (size_t level = 0; level < sizeof(rollup_levels) / sizeof(rollup_levels[0]); ++level) {
+        resolution = static_cast<int>(level);
+        if (span / rollup_levels[level].width_ <= max_points) {
+          break;
+        }
+      }
+    }
+  }
+
+  size_t first = rows.size();
+  int64_t raw_from = from;
+  if (resolution >= 0) {
+    const auto& level = rollup_levels[resolution];
+    std::vector<Sample> fields[RollupSeries::FieldCount];
+    // Includes the bucket which started before from, saturated for an open range.
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    int64_t bucket_from = from <= min + level.width_ ? min : from - level.width_ + 1;
+    for (int field = 0; field < RollupSeries::FieldCount; ++field) {
+      if (const auto* series = find(RollupSeries::key(path, level, static_cast<RollupSeries::Field>(field)))) {
+        series->read(bucket_from, to, fields[field]);
+      }
+    }
+
+    // The aggregates are appended together, so the series only differ if a block was lost.
+    size_t index[RollupSeries::FieldCount] = {0, 0, 0, 0};
+    for (const auto& mean : fields[RollupSeries::Mean]) {
+      HistoryRow row{mean.timestamp_, mean.value_, mean.value_, mean.value_, mean.value_};
+      double* targets[RollupSeries::FieldCount] = {&row.min_, &row.max_, nullptr, &row.last_};
+      for (int field = 0; field < RollupSeries::FieldCount; ++field) {
+        auto& samples = fields[field];
+        auto& i = index[field];
+        while (i < samples.size() && samples[i].timestamp_ < mean.timestamp_) {
+          ++i;
+        }
+        if (targets[field] && i < samples.size() && samples[i].timestamp_ == mean.timestamp_) {
+          *targets[field] = samples[i].value_;
+        }
+      }
+      rows.push_back(row);
+      raw_from = mean.timestamp_ + level.width_;
+    }
+  }
+
+  std::vector<Sample> samples;
+  raw->read(std::max(from, raw_from), to, samples);
+  for (const auto& sample : samples) {
+    rows.push_back(HistoryRow{sample.timestamp_, sample.value_, sample.value_, sample.value_, sample.value_});
+  }
+
+  return rows.size() - first;
+}
+
+
+HistorySeries& HistoryStore::series(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return series_locked(key);
+}
+
+
+HistorySeries& HistoryStore::series_locked(const std::string& key)
+{
+  auto& entry = series_[key];
+  if (!entry) {
+    entry.reset(new HistorySeries(key, retention_, storage_.get()));
+  }
+  return *entry;
+}
+
+
+const HistorySeries* HistoryStore::find(const std::string& path) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = series_.find(path);
+  return it != series_.end() ? it->second.get() : nullptr;
+}
+
+
+size_t HistoryStore::memory_usage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t usage = 0;
+  for (const auto& entry : series_) {
+    usage += entry.second->memory_usage();
+  }
+  return usage;
+}
+
+
+static bool parse_time(const std::string& text, int64_t& timestamp)
+{
+  struct tm tm;
+  std::memset(&tm, 0, sizeof(tm));
+  int consumed = 0;
+  if (std::sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+        &tm.tm_min, &tm.tm_sec, &consumed) != 6) {
+    return false;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+
+  int64_t millis = 0;
+  const char* rest = text.c_str() + consumed;
+  if (*rest == '.') {
+    ++rest;
+    int digits = 0;
+    while (*rest >= '0' && *rest <= '9') {
+      if (digits < 3) {
+        millis = millis * 10 + (*rest - '0');
+        ++digits;
+      }
+      ++rest;
+    }
+    for (; digits < 3; ++digits) {
+      millis *= 10;
+    }
+  }
+
+  int64_t offset = 0;
+  if (*rest == '+' || *rest == '-') {
+    int hours = 0;
+    int minutes = 0;
+    if (std::sscanf(rest + 1, "%2d:%2d", &hours, &minutes) < 1) {
+      return false;
+    }
+    offset = (hours * 60 + minutes) * 60;
+    if (*rest == '-') {
+      offset = -offset;
+    }
+  }
+
+  timestamp = (static_cast<int64_t>(timegm(&tm)) - offset) * 1000 + millis;
+  return true;
+}
+
+
+bool parse_time_range(const std::string& range, int64_t& from, int64_t& to)
+{
+  from = std::numeric_limits<int64_t>::min();
+  to = std::numeric_limits<int64_t>::max();
+  if (range.empty()) {
+    return true;
+  }
+
+  auto separator = range.find('/');
+  if (separator == std::string::npos) {
+    return parse_time(range, from);
+  }
+  return parse_time(range.substr(0, separator), from) && parse_time(range.substr(separator + 1), to);
+}
+
+
+std::string format_time(int64_t timestamp)
+{
+  time_t seconds = static_cast<time_t>(timestamp / 1000);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+
+  char text[64];
+  std::snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", tm.tm_year + 1900, tm.tm_mon + 1,
+    tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(timestamp % 1000));
+  return text;
+}
@@ -0,0 +1,161 @@
+/// @file history.h
+
+#pragma once
+
+#include "gorilla.h"
+#include "rollup.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// @brief Provides the memory for history blocks, e.g. from persistent history segments.
+class BlockStorage
+{
+public:
+  virtual ~BlockStorage() = default;
+
+  /// Provides a new, empty block for a series.
+  /// @param path The node path of the series.
+  /// @param timestamp The timestamp of the first sample that will be written to the block.
+  /// @return The block or nullptr if the storage cannot provide one, in which case the block is kept on the heap.
+  virtual std::shared_ptr<GorillaBlock> allocate(const std::string& path, int64_t timestamp) = 0;
+
+  /// Informs the storage that a series moved on to a new block and the given one will not be written anymore.
+  /// @param block The sealed block.
+  virtual void seal(const GorillaBlock& block) = 0;
+};
+
+
+/// @brief History of a single metric as a list of compressed blocks.
+/// There must only be one writer, but any number of threads may read concurrently without taking a lock. The block
+/// list is replaced copy-on-write whenever a block is sealed, readers work on the snapshot they loaded, so blocks
+/// which drop out of the retention window stay alive until the last reader is done with them.
+class HistorySeries
+{
+public:
+  /// Constructs an empty series.
+  /// @param path The node path of the metric.
+  /// @param retention How far back samples are retained in ms.
+  /// @param storage Provides the blocks, if nullptr they are allocated on the heap.
+  HistorySeries(const std::string& path, int64_t retention, BlockStorage* storage);
+
+  /// Adds a block which was written by a previous run of the link. Must be called before the first append.
+  /// Appends continue after the last sample of the block, or after the current time if that is earlier.
+  /// @param block The block to add, its checksum has to be valid.
+  void restore(std::shared_ptr<GorillaBlock> block);
+
+  /// Appends a sample. Must only be called by the writer thread.
+  /// @param timestamp Observation time in ms since the epoch.
+  /// @param value The observed value.
+  /// @return false if the sample is not newer than the last one and was dropped.
+  bool append(int64_t timestamp, double value);
+
+  /// Copies all retained samples with from <= timestamp <= to into out, oldest first.
+  /// @param from Start of the time range in ms since the epoch.
+  /// @param to End of the time range in ms since the epoch.
+  /// @param out The vector to append the samples to.
+  /// @return The number of samples appended.
+  size_t read(int64_t from, int64_t to, std::vector<Sample>& out) const;
+
+  /// Returns the timestamp of the oldest retained sample or 0 if the series is empty.
+  /// @return The oldest timestamp.
+  int64_t first_timestamp() const;
+
+  /// Returns the timestamp of the newest sample or 0 if the series is empty.
+  /// @return The newest timestamp.
+  int64_t last_timestamp() const;
+
+  /// Returns the memory held by the blocks of this series, wherever their storage lives.
+  /// @return The size in bytes.
+  size_t memory_usage() const;
+
+private:
+  using Blocks = std::vector<std::shared_ptr<GorillaBlock>>;
+
+  std::string path_;
+  int64_t retention_;
+  BlockStorage* storage_;
+  std::shared_ptr<const Blocks> blocks_; ///< Only accessed via std::atomic_load and std::atomic_store.
+  std::shared_ptr<GorillaBlock> open_;   ///< The block currently appended to, owned by the writer.
+  int64_t last_timestamp_{0};
+};
+
+
+/// @brief History of all metrics of the link, keyed by the node path of the metric.
+/// The map itself is guarded by a mutex, the series are never removed, so lookups hand out stable pointers and the
+/// actual sample access is lock free. Every metric is also rolled up to the rollup_levels, the rollups are stored as
+/// additional series next to the raw one.
+class HistoryStore
+{
+public:
+  /// Resolution for query which picks the finest level that answers the time range with at most max_points rows.
+  static const int auto_resolution = -1;
+  /// Resolution for query which returns the raw samples.
+  static const int raw_resolution = -2;
+  /// Number of rows an automatic query aims for.
+  static const int64_t max_points = 500;
+
+  /// Constructs an empty store.
+  /// @param retention How far back samples are retained in ms.
+  /// @param storage Provides the blocks, if nullptr they are allocated on the heap.
+  explicit HistoryStore(int64_t retention, std::shared_ptr<BlockStorage> storage = nullptr);
+
+  /// Adds a block which was written by a previous run of the link to the series of the given path.
+  /// @param path The node path of the metric.
+  /// @param block The block to add.
+  void restore(const std::string& path, std::shared_ptr<GorillaBlock> block);
+
+  /// Appends a sample to the series of the given path, creating the series on first use.
+  /// @param path The node path of the metric.
+  /// @param timestamp Observation time in ms since the epoch.
+  /// @param value The observed value.
+  void append(const std::string& path, int64_t timestamp, double value);
+
+  /// Reads the history of a metric for a time range. Rollup rows cover the completed buckets, samples which are not
+  /// rolled up yet are appended as raw rows.
+  /// @param path The node path of the metric.
+  /// @param from Start of the time range in ms since the epoch.
+  /// @param to End of the time range in ms since the epoch.
+  /// @param resolution Index into rollup_levels, auto_resolution or raw_resolution.
+  /// @param rows The vector to append the rows to.
+  /// @return The number of rows appended.
+  size_t query(const std::string& path, int64_t from, int64_t to, int resolution, std::vector<HistoryRow>& rows) const;
+
+  /// Returns the series for the given path.
+  /// @param path The node path of the metric.
+  /// @return The series or nullptr if nothing was recorded for this path yet.
+  const HistorySeries* find(const std::string& path) const;
+
+  /// Returns the memory held by all series.
+  /// @return The size in bytes.
+  size_t memory_usage() const;
+
+private:
+  HistorySeries& series(const std::string& key);
+  HistorySeries& series_locked(const std::string& key);
+
+  int64_t retention_;
+  std::shared_ptr<BlockStorage> storage_;
+  mutable std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<HistorySeries>> series_; ///< Raw and rollup series by key.
+  std::map<std::string, std::vector<RollupSeries>> rollups_;     ///< Rollups by node path, one per level.
+};
+
+
+/// Parses a DSA time range of the form `<start>/<end>` with ISO 8601 timestamps as produced by the date range editor.
+/// An empty string selects everything.
+/// @param range The time range string.
+/// @param from Receives the start in ms since the epoch.
+/// @param to Receives the end in ms since the epoch.
+/// @return false if the range could not be parsed.
+bool parse_time_range(const std::string& range, int64_t& from, int64_t& to);
+
+/// Formats a timestamp as ISO 8601 string in UTC, e.g. `2019-02-26T17:19:04.000Z`.
+/// @param timestamp The time in ms since the epoch.
+/// @return The formatted timestamp.
+std::string format_time(int64_t timestamp);
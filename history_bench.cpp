@@ -0,0 +1,100 @@
+#include "history.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+using namespace std;
+
+
+// Synthetic per-minute weather series. Like the real API, values only change when the station reports a new
+// observation, roughly every ten minutes, and every now and then a poll is late by a second or two.
+struct Metric
+{
+  const char* name;
+  double start;
+  double step;
+  double resolution;
+};
+
+
+int main()
+{
+  const int64_t minute = 60 * 1000;
+  const int64_t week = 7 * 24 * 60 * minute;
+  const int64_t start = 1551201544000;
+  const size_t locations = 5000;
+  const Metric metrics[] = {
+    {"temp", 288.05, 0.3, 0.01},
+    {"pressure", 1031, 1, 1},
+    {"humidity", 55, 2, 1},
+    {"temp_min", 284.15, 0.3, 0.01},
+    {"temp_max", 291.15, 0.3, 0.01},
+    {"wind", 3.6, 0.5, 0.1},
+  };
+
+  mt19937 random(42);
+  normal_distribution<double> walk(0.0, 1.0);
+  uniform_int_distribution<int> jitter(0, 39);
+
+  size_t total_samples = 0;
+  size_t total_bytes = 0;
+  for (const auto& metric : metrics) {
+    HistorySeries series(metric.name, week, nullptr);
+    double value = metric.start;
+    size_t samples = 0;
+    for (int64_t t = start; t < start + week; t += minute) {
+      if (samples % 10 == 0) {
+        value = round((value + walk(random) * metric.step) / metric.resolution) * metric.resolution;
+      }
+      int late = jitter(random);
+      series.append(late < 2 ? t + (late + 1) * 1000 : t, value);
+      ++samples;
+    }
+
+    vector<Sample> out;
+    out.reserve(samples);
+    const int rounds = 50;
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      out.clear();
+      series.read(start - minute, start + week + minute, out);
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+
+    size_t bytes = series.memory_usage();
+    printf("%-10s %7zu samples %8zu bytes %5.2f bytes/sample decode %6.1f ns/sample\n", metric.name, out.size(),
+      bytes, double(bytes) / samples, double(elapsed) / (rounds * out.size()));
+    total_samples += samples;
+    total_bytes += bytes;
+  }
+
+  printf("\naverage %.2f bytes/sample, a week of %zu locations x %zu metrics takes %.0f MB\n",
+    double(total_bytes) / total_samples, locations, sizeof(metrics) / sizeof(metrics[0]),
+    double(total_bytes) * locations / (1024 * 1024));
+
+  // Long range queries are answered from the rollups.
+  HistoryStore store(week);
+  double value = metrics[0].start;
+  for (int64_t t = start; t < start + week; t += minute) {
+    value = round((value + walk(random) * metrics[0].step) / metrics[0].resolution) * metrics[0].resolution;
+    store.append("/temp", t, value);
+  }
+  const struct
+  {
+    const char* name;
+    int64_t span;
+  } ranges[] = {{"1 hour", 60 * minute}, {"1 day", 24 * 60 * minute}, {"1 week", week}};
+  for (const auto& range : ranges) {
+    vector<HistoryRow> rows;
+    const int rounds = 200;
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      rows.clear();
+      store.query("/temp", start + week - range.span, start + week, HistoryStore::auto_resolution, rows);
+    }
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    printf("query %-7s %5zu rows %8.1f us\n", range.name, rows.size(), double(elapsed) / rounds);
+  }
+}
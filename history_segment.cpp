@@ -0,0 +1,290 @@
+#include "history_segment.h"
+#include "checksum.h"
+#include "error_code.h"
+
+#include <efm_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+const char segment_magic[8] = {'O', 'W', 'M', 'H', 'I', 'S', 'T', '\0'};
+const uint32_t segment_version = 1;
+const uint32_t slot_magic = 0x534C4F54; // "SLOT"
+const size_t header_size = 64;
+
+struct SegmentHeader
+{
+  char magic_[8];
+  uint32_t version_;
+  uint32_t slot_size_;
+  uint32_t slot_count_;
+  uint32_t checksum_; ///< CRC-32 of the header with this field set to 0.
+  int64_t created_;
+};
+
+struct SegmentSlot
+{
+  uint32_t magic_;       ///< Written last when the slot is allocated.
+  uint32_t checksum_;    ///< CRC-32 of the path.
+  uint32_t path_length_;
+  char path_[116];
+  GorillaBlockData block_;
+};
+
+static_assert(sizeof(SegmentHeader) <= header_size, "segment header does not fit");
+static_assert(sizeof(SegmentSlot) % 8 == 0, "segment slots have to keep the blocks aligned");
+
+uint32_t header_checksum(SegmentHeader header)
+{
+  header.checksum_ = 0;
+  return crc32(&header, sizeof(header));
+}
+}
+
+
+struct HistorySegments::Segment
+{
+  std::string file_name_;
+  char* address_{nullptr};
+  size_t size_{0};
+  uint32_t slot_count_{0};
+  int64_t created_{0};
+
+  ~Segment()
+  {
+    if (address_) {
+      munmap(address_, size_);
+    }
+  }
+
+  SegmentSlot& slot(uint32_t index) const
+  {
+    return *reinterpret_cast<SegmentSlot*>(address_ + header_size + index * sizeof(SegmentSlot));
+  }
+
+  int64_t last_timestamp() const
+  {
+    int64_t last = 0;
+    for (uint32_t i = 0; i < slot_count_; ++i) {
+      const auto& s = slot(i);
+      if (s.magic_ == slot_magic && s.block_.count_.load(std::memory_order_acquire) > 0) {
+        last = std::max(last, s.block_.last_timestamp_.load(std::memory_order_relaxed));
+      }
+    }
+    return last;
+  }
+};
+
+
+HistorySegments::HistorySegments(const Settings& settings)
+  : settings_(settings)
+{
+}
+
+
+HistorySegments::~HistorySegments()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (current_) {
+    msync(current_->address_, current_->size_, MS_SYNC);
+  }
+}
+
+
+size_t HistorySegments::load(HistoryStore& store)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<uint32_t> sequences;
+  if (DIR* dir = opendir(settings_.directory_.c_str())) {
+    while (dirent* entry = readdir(dir)) {
+      unsigned sequence;
+      char suffix[8];
+      if (std::sscanf(entry->d_name, "history-%8u.%3s", &sequence, suffix) == 2 && std::strcmp(suffix, "seg") == 0) {
+        sequences.push_back(sequence);
+      }
+    }
+    closedir(dir);
+  } else if (mkdir(settings_.directory_.c_str(), 0755) != 0) {
+    LOG_EFM_ERROR(responder_error_code::history_segment, settings_.directory_ << ": " << std::strerror(errno));
+  }
+  std::sort(sequences.begin(), sequences.end());
+
+  size_t restored = 0;
+  size_t damaged = 0;
+  for (auto sequence : sequences) {
+    next_sequence_ = sequence + 1;
+
+    auto segment = std::make_shared<Segment>();
+    segment->file_name_ = file_name(sequence);
+
+    int fd = open(segment->file_name_.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < header_size) {
+      LOG_EFM_ERROR(responder_error_code::history_segment, segment->file_name_ << ": cannot open");
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+    segment->size_ = static_cast<size_t>(info.st_size);
+    void* address = mmap(nullptr, segment->size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+      LOG_EFM_ERROR(responder_error_code::history_segment, segment->file_name_ << ": " << std::strerror(errno));
+      continue;
+    }
+    segment->address_ = static_cast<char*>(address);
+
+    const auto& header = *reinterpret_cast<const SegmentHeader*>(segment->address_);
+    if (std::memcmp(header.magic_, segment_magic, sizeof(segment_magic)) != 0 || header.version_ != segment_version ||
+        header.slot_size_ != sizeof(SegmentSlot) || header.checksum_ != header_checksum(header)) {
+      LOG_EFM_ERROR(responder_error_code::history_segment, segment->file_name_ << ": invalid header");
+      continue;
+    }
+    segment->created_ = header.created_;
+    segment->slot_count_ = std::min<uint32_t>(header.slot_count_,
+      static_cast<uint32_t>((segment->size_ - header_size) / sizeof(SegmentSlot)));
+
+    for (uint32_t i = 0; i < segment->slot_count_; ++i) {
+      auto& slot = segment->slot(i);
+      if (slot.magic_ != slot_magic || slot.path_length_ > sizeof(slot.path_) ||
+          slot.checksum_ != crc32(slot.path_, slot.path_length_) || slot.block_.count_.load() == 0) {
+        continue;
+      }
+      auto block = std::make_shared<GorillaBlock>(&slot.block_, segment, false);
+      if (!block->valid()) {
+        ++damaged;
+        continue;
+      }
+      store.restore(std::string(slot.path_, slot.path_length_), std::move(block));
+      ++restored;
+    }
+    segments_.push_back(segment);
+  }
+
+  if (damaged > 0) {
+    LOG_EFM_ERROR(responder_error_code::history_segment, damaged << " damaged blocks skipped");
+  }
+  return restored;
+}
+
+
+std::shared_ptr<GorillaBlock> HistorySegments::allocate(const std::string& path, int64_t timestamp)
+{
+  if (path.size() > sizeof(SegmentSlot::path_)) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!current_ || next_slot_ == current_->slot_count_ ||
+      timestamp - current_->created_ >= settings_.segment_duration_.count()) {
+    if (!rotate(timestamp)) {
+      return nullptr;
+    }
+  }
+
+  auto& slot = current_->slot(next_slot_++);
+  std::memcpy(slot.path_, path.data(), path.size());
+  slot.path_length_ = static_cast<uint32_t>(path.size());
+  slot.checksum_ = crc32(slot.path_, slot.path_length_);
+  __atomic_store_n(&slot.magic_, slot_magic, __ATOMIC_RELEASE);
+
+  return std::make_shared<GorillaBlock>(&slot.block_, current_, true);
+}
+
+
+void HistorySegments::seal(const GorillaBlock& block)
+{
+  static const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto begin = reinterpret_cast<uintptr_t>(&block.data());
+  auto end = begin + sizeof(GorillaBlockData);
+  begin &= ~(page_size - 1);
+  msync(reinterpret_cast<void*>(begin), end - begin, MS_ASYNC);
+}
+
+
+bool HistorySegments::rotate(int64_t timestamp)
+{
+  if (current_) {
+    msync(current_->address_, current_->size_, MS_ASYNC);
+  }
+
+  if (settings_.segment_bytes_ < header_size + sizeof(SegmentSlot)) {
+    LOG_EFM_ERROR(responder_error_code::history_segment, "segment size " << settings_.segment_bytes_ << " holds no block");
+    return false;
+  }
+  uint32_t slot_count = static_cast<uint32_t>((settings_.segment_bytes_ - header_size) / sizeof(SegmentSlot));
+  auto segment = std::make_shared<Segment>();
+  segment->file_name_ = file_name(next_sequence_++);
+  segment->size_ = header_size + slot_count * sizeof(SegmentSlot);
+  segment->slot_count_ = slot_count;
+  segment->created_ = timestamp;
+
+  // The file is sparse, untouched slots take no disk space and read as zero.
+  int fd = open(segment->file_name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, static_cast<off_t>(segment->size_)) != 0) {
+    LOG_EFM_ERROR(responder_error_code::history_segment, segment->file_name_ << ": " << std::strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  void* address = mmap(nullptr, segment->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    LOG_EFM_ERROR(responder_error_code::history_segment, segment->file_name_ << ": " << std::strerror(errno));
+    return false;
+  }
+  segment->address_ = static_cast<char*>(address);
+
+  SegmentHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic_, segment_magic, sizeof(segment_magic));
+  header.version_ = segment_version;
+  header.slot_size_ = sizeof(SegmentSlot);
+  header.slot_count_ = slot_count;
+  header.created_ = timestamp;
+  header.checksum_ = header_checksum(header);
+  std::memcpy(segment->address_, &header, sizeof(header));
+
+  remove_expired(timestamp);
+
+  current_ = segment;
+  next_slot_ = 0;
+  segments_.push_back(segment);
+  return true;
+}
+
+
+void HistorySegments::remove_expired(int64_t timestamp)
+{
+  // Blocks of a removed segment stay mapped until their series drop them, unlinking only frees the name.
+  auto expired = [&](const std::shared_ptr<Segment>& segment) {
+    if (segment->last_timestamp() >= timestamp - settings_.retention_) {
+      return false;
+    }
+    unlink(segment->file_name_.c_str());
+    return true;
+  };
+  segments_.erase(std::remove_if(segments_.begin(), segments_.end(), expired), segments_.end());
+}
+
+
+std::string HistorySegments::file_name(uint32_t sequence) const
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "/history-%08u.seg", sequence);
+  return settings_.directory_ + name;
+}
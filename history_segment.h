@@ -0,0 +1,64 @@
+/// @file history_segment.h
+
+#pragma once
+
+#include "history.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// @brief Persistent BlockStorage in memory mapped segment files.
+/// A segment is a file of fixed size slots, each holding the node path of a series and one GorillaBlock. The blocks
+/// are encoded directly into the shared mapping, so every appended sample is in the page cache and survives a crash
+/// of the link without a write call. Each block carries a checksum over its content which is updated on every append.
+///
+/// The writable segment is rotated when it is full or older than the configured duration. On restart all segments
+/// are mapped read-only and their blocks are handed to the HistoryStore as they are, nothing is decoded or copied.
+/// Restored blocks whose checksum does not match are skipped.
+class HistorySegments : public BlockStorage
+{
+public:
+  /// Settings of the segment files.
+  struct Settings
+  {
+    std::string directory_;                     ///< Directory of the segment files.
+    size_t segment_bytes_{64 * 1024 * 1024};    ///< Maximum size of a segment file.
+    std::chrono::milliseconds segment_duration_{std::chrono::hours(1)}; ///< Maximum age of the writable segment.
+    int64_t retention_{24 * 60 * 60 * 1000};    ///< Segments whose newest sample is older than this are deleted.
+  };
+
+  /// Constructs the storage. No file is touched before load or the first allocate.
+  /// @param settings The segment settings.
+  explicit HistorySegments(const Settings& settings);
+
+  /// Syncs the writable segment.
+  ~HistorySegments();
+
+  /// Maps all existing segments read-only and restores their blocks into the store.
+  /// @param store The store to restore the blocks into.
+  /// @return The number of restored blocks.
+  size_t load(HistoryStore& store);
+
+  std::shared_ptr<GorillaBlock> allocate(const std::string& path, int64_t timestamp) override;
+
+  void seal(const GorillaBlock& block) override;
+
+private:
+  struct Segment;
+
+  bool rotate(int64_t timestamp);
+  void remove_expired(int64_t timestamp);
+  std::string file_name(uint32_t sequence) const;
+
+  Settings settings_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Segment>> segments_; ///< All segments still on disk, the writable one last.
+  std::shared_ptr<Segment> current_;
+  uint32_t next_slot_{0};
+  uint32_t next_sequence_{0};
+};
@@ -0,0 +1,15 @@
+/// @file location.h
+
+#pragma once
+
+#include <string>
+
+
+/// A location the link polls the weather APIs for.
+struct Location
+{
+  std::string path_;    ///< Node path the values of the location are published under.
+  std::string query_;   ///< Location query of the API, e.g. "q=London,uk" or "id=2643743".
+  double latitude_;     ///< Latitude in degrees, for the APIs which only take coordinates.
+  double longitude_;    ///< Longitude in degrees.
+};
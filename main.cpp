@@ -2,77 +2,147 @@
 #include <efm_link_options.h>
 #include <efm_logging.h>
 #include <curl/curl.h>
+#include "async_log.h"
+#include "catalog_tree.h"
+#include "city_catalog.h"
+#include "city_index.h"
+#include "endpoint.h"
 #include "error_code.h"
-#include "rapidjson/document.h"
+#include "fetcher.h"
+#include "forecast.h"
+#include "history.h"
+#include "history_segment.h"
+#include "metrics.h"
+#include "observation.h"
+#include "observation_publisher.h"
+#include "parse_pool.h"
+#include "pipeline.h"
+#include "publisher.h"
+#include "scheduler.h"
+#include "recording.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "subscriptions.h"
+#include "trace.h"
+#include "weather_config.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 
-using namespace rapidjson;
 using namespace cisco::efm_sdk;
 using namespace std;
 
 
-static char errorBuffer[CURL_ERROR_SIZE];
-static string buffer;
-
-static int writer(char *data, size_t size, size_t nmemb, std::string *writerData){
-  if(writerData == NULL) return 0;
-  writerData->append(data, size*nmemb);
-  return size * nmemb;
+namespace
+{
+int64_t microseconds_since(chrono::steady_clock::time_point start)
+{
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
 }
 
-static bool initCURL(CURL *&conn, const string& url){
-  CURLcode code;
-  conn = curl_easy_init();
-  
-
+/// Time spent in the EndpointSink by the current Endpoint::process call of the thread, it is not part of the parse time.
+thread_local int64_t sink_time = 0;
 
-  if(conn == NULL) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to create CURL connection");
-    exit(EXIT_FAILURE);
-  }
-
-  code = curl_easy_setopt(conn, CURLOPT_ERRORBUFFER, errorBuffer);
-  if(code != CURLE_OK) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to set error buffer");
-    return false;
-  }
+/// Adds the lifetime to sink_time.
+struct SinkTimer
+{
+  chrono::steady_clock::time_point start_{chrono::steady_clock::now()};
 
-  code = curl_easy_setopt(conn, CURLOPT_URL, url.c_str());
-  if(code != CURLE_OK) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to set URL" );
-    return false;
+  ~SinkTimer()
+  {
+    sink_time += microseconds_since(start_);
   }
+};
 
-  code = curl_easy_setopt(conn, CURLOPT_FOLLOWLOCATION, 1L);
-  if(code != CURLE_OK) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to set redirect option ");
-    return false;
-  }
+/// One poll of an endpoint, shared by the jobs it queued.
+struct PollCycle
+{
+  Endpoint* endpoint_{nullptr};
+  Scheduler::Task task_{0};   ///< The scheduler task of the endpoint.
+  atomic<size_t> pending_{0}; ///< Jobs which did not finish yet.
+  bool traced_{false};
+  size_t skipped_{0};        ///< Locations which were not due.
+};
 
-  code = curl_easy_setopt(conn, CURLOPT_WRITEFUNCTION, writer);
-  if(code != CURLE_OK) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to set writer ");
-    return false;
-  }
+struct FetchJob
+{
+  shared_ptr<PollCycle> cycle_;
+  size_t location_;
+};
 
-  code = curl_easy_setopt(conn, CURLOPT_WRITEDATA, &buffer);
-  if(code != CURLE_OK) {
-    LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to set write data ");
-    return false;
-  }
+struct ParseJob
+{
+  shared_ptr<PollCycle> cycle_;
+  size_t location_;
+  string body_;
+  int64_t fetched_; ///< Time the response was received in ms since the epoch.
+};
 
-  return true;
+/// Maximum number of spilled observations replayed at once.
+const size_t replay_chunk = 500;
 }
 
 
-class OpenWeatherDataLink
+class OpenWeatherDataLink : public EndpointSink
 {
 public:
  
-  OpenWeatherDataLink(Link& link) : link_(link) , responder_(link.responder()) { }
+  OpenWeatherDataLink(Link& link, const WeatherConfig& config, LogLevel log_level)
+    : link_(link) , responder_(link.responder()), config_(config)
+    , segments_(make_segments(config))
+    , history_(chrono::duration_cast<chrono::milliseconds>(config.history_retention).count(), segments_)
+    , subscriptions_(config.locations)
+    , responder_sink_(link)
+    , publisher_(responder_sink_, metrics_, config.publish_stage, config.stage_queue_capacity, config.publish_budget)
+    , observation_publisher_(publisher_, responder_sink_, observations_, history_, subscriptions_, log_,
+        bind(&OpenWeatherDataLink::nodes_created, this, placeholders::_1, placeholders::_2))
+    , fetcher_(config.requests_per_minute, config.http_connections, config.http_streams, config.http_connect_timeout,
+        config.http_timeout)
+    , fetch_queue_(config.stage_queue_capacity)
+    , scheduler_(link)
+  {
+    log_.set_debug(log_level == LogLevel::Debug, config.payload_dump_interval);
+    Trace::set_sample_percent(config.trace_sample_percent);
+
+    if (!config.spill_dir.empty()) {
+      spill_.reset(new Spill(config.spill_dir, static_cast<uint64_t>(config.spill_mb) * 1024 * 1024));
+    }
+    endpoints_.emplace_back(new WeatherEndpoint(config.poll_interval));
+    owd_node_ = publisher_.intern(OWDPath);
+    parse_pool_.reset(new ParsePool(config.parse_stage, config.stage_queue_capacity));
+    if (config.forecast_interval.count() > 0) {
+      auto* forecast = new ForecastEndpoint(config.forecast_interval);
+      auto* pool = parse_pool_.get();
+      forecast->set_parallel(bind(&ParsePool::parallel_for, pool, placeholders::_1, placeholders::_2),
+        bind(&ParsePool::idle, pool), config.parse_split_kb * 1024);
+      endpoints_.emplace_back(forecast);
+    }
+    if (config.air_pollution_interval.count() > 0) {
+      endpoints_.emplace_back(new AirPollutionEndpoint(config.air_pollution_interval));
+    }
+
+    fetch_stage_.reset(new Stage("fetch", config.fetch_stage, [this]() { this->fetch_worker(); }));
+    for (auto& endpoint : endpoints_) {
+      auto* polled = endpoint.get();
+      scheduler_.add(endpoint->interval(), [this, polled](Scheduler::Task task) { this->poll(*polled, task); });
+    }
+  }
+
+  /// Stops the stages. Queued requests are dropped, fetched responses are still processed and published.
+  ~OpenWeatherDataLink()
+  {
+    stopping_ = true;
+    fetch_queue_.close();
+    fetch_stage_.reset();
+    parse_pool_.reset();
+  }
 
   void initialize(const std::string& link_name, const std::error_code& ec)
   {
@@ -80,6 +150,29 @@ public:
       LOG_EFM_DEBUG( "OpenWeatherDataLink", DebugLevel::l1, "Responder link '" << link_name << "' initialized");
     else 
       LOG_EFM_ERROR(ec, "could not initialize responder link");
+
+    if (!config_.record_file.empty() && !recorder_.open(config_.record_file)) {
+      LOG_EFM_ERROR(responder_error_code::recording_error, "could not open " << config_.record_file);
+    }
+
+    if (spill_ && !spill_->open()) {
+      LOG_EFM_ERROR(responder_error_code::spill_error, "could not open " << config_.spill_dir << ", not polling while disconnected");
+      spill_.reset();
+    }
+
+    if (segments_) {
+      LOG_EFM_INFO(responder_error_code::history_restored, segments_->load(history_) << " from " << config_.history_dir);
+    }
+
+    if (!config_.city_list.empty() || !config_.city_catalog.empty()) {
+      auto start = chrono::steady_clock::now();
+      if (load_cities(config_.city_list, config_.city_catalog, cities_)) {
+        city_index_.build(cities_);
+        catalog_tree_.build(cities_);
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        LOG_EFM_INFO(responder_error_code::city_catalog_loaded, cities_.size() << " cities in " << elapsed.count() << " ms");
+      }
+    }
     
 
     NodeBuilder builder{"/"};
@@ -107,9 +200,119 @@ public:
                 .add_column({"Success", ValueType::Bool})
                 .add_column({"Message", ValueType::String}));
 
-    responder_.add_node( move(builder),
-      bind(&OpenWeatherDataLink::nodes_created, this, placeholders::_1, placeholders::_2)
-    );
+    builder.make_node("get_history")
+      .display_name("Get History")
+      .action(Action( PermissionLevel::Read,
+                bind( &OpenWeatherDataLink::get_history_called, this,
+                 placeholders::_1, placeholders::_2, placeholders::_3, placeholders::_4
+                ))
+                .add_param(ActionParameter{"Path", ValueType::String})
+                .add_param(ActionParameter{"Timerange", ValueType::String}.editor(editor::DateRange()))
+                .add_param(ActionParameter{"Resolution", ValueType::Enum}.enum_values("auto,raw,10m,1h"))
+                .add_column({"Timestamp", ValueType::Time})
+                .add_column({"Value", ValueType::Number})
+                .add_column({"Min", ValueType::Number})
+                .add_column({"Max", ValueType::Number})
+                .add_column({"Last", ValueType::Number})
+                .set_table());
+
+    builder.make_node("find_nearest_city")
+      .display_name("Find Nearest City")
+      .action(Action( PermissionLevel::Read,
+                bind( &OpenWeatherDataLink::find_nearest_city_called, this,
+                 placeholders::_1, placeholders::_2, placeholders::_3, placeholders::_4
+                ))
+                .add_param(ActionParameter{"Coordinates", ValueType::String})
+                .add_column({"Latitude", ValueType::Number})
+                .add_column({"Longitude", ValueType::Number})
+                .add_column({"City ID", ValueType::Int})
+                .add_column({"Name", ValueType::String})
+                .add_column({"Country", ValueType::String})
+                .add_column({"Distance", ValueType::Number})
+                .set_table());
+
+    builder.make_node("find_cities_in_box")
+      .display_name("Find Cities In Box")
+      .action(Action( PermissionLevel::Read,
+                bind( &OpenWeatherDataLink::find_cities_in_box_called, this,
+                 placeholders::_1, placeholders::_2, placeholders::_3, placeholders::_4
+                ))
+                .add_param(ActionParameter{"South", ValueType::Number})
+                .add_param(ActionParameter{"West", ValueType::Number})
+                .add_param(ActionParameter{"North", ValueType::Number})
+                .add_param(ActionParameter{"East", ValueType::Number})
+                .add_column({"City ID", ValueType::Int})
+                .add_column({"Name", ValueType::String})
+                .add_column({"Country", ValueType::String})
+                .add_column({"Latitude", ValueType::Number})
+                .add_column({"Longitude", ValueType::Number})
+                .set_table());
+
+    builder.make_node("get_forecast")
+      .display_name("Get Forecast")
+      .action(Action( PermissionLevel::Read,
+                bind( &OpenWeatherDataLink::get_forecast_called, this,
+                 placeholders::_1, placeholders::_2, placeholders::_3, placeholders::_4
+                ))
+                .add_param(ActionParameter{"Path", ValueType::String})
+                .add_column({"Timestamp", ValueType::Time})
+                .add_column({"Temperature", ValueType::Number})
+                .add_column({"Feels Like", ValueType::Number})
+                .add_column({"Min", ValueType::Number})
+                .add_column({"Max", ValueType::Number})
+                .add_column({"Pressure", ValueType::Number})
+                .add_column({"Humidity", ValueType::Number})
+                .add_column({"Clouds", ValueType::Number})
+                .add_column({"Wind Speed", ValueType::Number})
+                .add_column({"Wind Direction", ValueType::Number})
+                .add_column({"Precipitation Probability", ValueType::Number})
+                .add_column({"Precipitation", ValueType::Number})
+                .add_column({"Description", ValueType::String})
+                .set_table());
+
+    builder.make_node("export_trace")
+      .display_name("Export Trace")
+      .action(Action( PermissionLevel::Read,
+                bind( &OpenWeatherDataLink::export_trace_called, this,
+                 placeholders::_1, placeholders::_2, placeholders::_3, placeholders::_4
+                ))
+                .add_param(ActionParameter{"File", ValueType::String})
+                .add_column({"Spans", ValueType::Int})
+                .add_column({"File", ValueType::String}));
+
+    if (cities_.size() > 0) {
+      builder.make_node("catalog").display_name("Catalog");
+      // Every country node gets its list callback when it is created, also when it is recreated after an eviction.
+      responder_.add_node_creation_callback("/catalog/*",
+        bind(&OpenWeatherDataLink::catalog_node_created, this, placeholders::_1, placeholders::_2, placeholders::_3));
+    }
+
+    responder_.add_node( move(builder), [this](const vector<NodePath>& paths, const std::error_code& ec) {
+      nodes_created(paths, ec);
+      if (!ec && cities_.size() > 0) {
+        create_catalog_countries();
+      }
+    });
+
+    // Warm start, the nodes get the last known values until the first poll has refreshed them.
+    vector<Observation> restored;
+    if (!config_.snapshot_file.empty() && load_snapshot(config_.snapshot_file, restored)) {
+      for (const auto& observation : restored) {
+        observations_.update(observation);
+        observation_publisher_.publish(observation,
+          chrono::system_clock::time_point(chrono::milliseconds(observation.observed_)),
+          subscriptions_.find(observation.path_));
+      }
+      publisher_.flush();
+      snapshot_version_ = observations_.version();
+      LOG_EFM_INFO(responder_error_code::snapshot_restored, restored.size() << " from " << config_.snapshot_file);
+    }
+    if (!config_.snapshot_file.empty()) {
+      link_.schedule_timed_task(config_.snapshot_interval, [&]() { this->snapshot(); });
+    }
+    if (config_.metrics_interval.count() > 0) {
+      link_.schedule_timed_task(config_.metrics_interval, [this]() { this->publish_metrics(); });
+    }
   }
 
 
@@ -124,72 +327,413 @@ public:
   }
 
 
-  
 
-  void getWeatherData() {
-    if (!disconnected_) { //defensive programming, do nothing if not connected to EFM
-      
-      CURL *conn = NULL;
-      CURLcode code;
-      
-      if(!initCURL(conn, "http://api.openweathermap.org/data/2.5/weather?q=London,uk&APPID=8fdc9a1f1fb74ac9dfed4803a57b02c6")) {
-        LOG_EFM_ERROR(responder_error_code::curl_error, " curl initializion failed ");
-        exit(EXIT_FAILURE);
-      }
+  /// Creates the country level of the /catalog tree, the cities are materialized when a country is listed.
+  void create_catalog_countries()
+  {
+    NodeBuilder builder{"/catalog"};
+    for (const auto& country : catalog_tree_.countries()) {
+      builder.make_node(country).display_name(country);
+    }
+    responder_.add_node( move(builder),
+      bind(&OpenWeatherDataLink::nodes_created, this, placeholders::_1, placeholders::_2)
+    );
+    link_.schedule_timed_task(chrono::minutes(1), [this]() { this->evict_catalog(); });
+  }
+
+
+  void catalog_node_created(const NodePath& path, NodeCreationContext, const std::error_code& ec)
+  {
+    // The pattern may match the city nodes as well, only the countries are listed lazily.
+    if (ec || path.get_parent_path() != NodePath("/catalog")) return;
+    responder_.register_callback(path, CallbackOn::ListOpen,
+      bind(&OpenWeatherDataLink::catalog_listed, this, placeholders::_1, placeholders::_2));
+  }
 
-      code = curl_easy_perform(conn);
-      curl_easy_cleanup(conn);
 
-      if(code != CURLE_OK) {
-        LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to GET" << errorBuffer);
-        exit(EXIT_FAILURE);
+  /// Creates the city nodes of a country when it is listed for the first time since it was evicted.
+  void catalog_listed(const NodePath& path, CallbackOn)
+  {
+    auto country = path.get_name();
+    vector<const City*> cities;
+    if (!catalog_tree_.materialize(country, CatalogTree::Clock::now(), cities) || cities.empty()) return;
+
+    NodeBuilder builder{path};
+    for (const auto* city : cities) {
+      auto name = cities_.name(*city);
+      builder.make_node(to_string(city->id_))
+        .display_name(name)
+        .type(ValueType::String)
+        .value(Variant{name})
+        .attribute("@latitude", Variant{static_cast<double>(city->latitude_)})
+        .attribute("@longitude", Variant{static_cast<double>(city->longitude_)})
+        .on_subscribe([this, country](bool subscribe) {
+          catalog_tree_.changed(country, subscribe, CatalogTree::Clock::now());
+        });
+    }
+    responder_.add_node(move(builder), [this, country](const vector<NodePath>& paths, const std::error_code& ec) {
+      nodes_created(paths, ec);
+      if (ec) return;
+      // A client browsing a city keeps its list open, every list of a city counts as a use of the country.
+      for (const auto& created : paths) {
+        responder_.register_callback(created, CallbackOn::ListOpen, [this, country](const NodePath&, CallbackOn) {
+          catalog_tree_.used(country, CatalogTree::Clock::now());
+        });
       }
+    });
+    LOG_EFM_DEBUG("OpenWeatherDataLink", DebugLevel::l1,
+      "materialized " << cities.size() << " cities of " << country << ", " << catalog_tree_.materialized() << " in total");
+  }
 
-      responder_.set_value(OWDPath, Variant{buffer}, std::chrono::system_clock::now(), [](const std::error_code&) {});
-      Document d;
-      cout<< buffer << "\n\n";
-      d.Parse(buffer.c_str());
-      buffer.clear();
-      
-      if( d["main"].IsObject() ){
-        NodeBuilder builder{"/"};
-        for (auto& m : d["main"].GetObject()){
-               
-          builder.make_node(m.name.GetString())
-            .display_name(m.name.GetString());
-            
-                 
-          printf("\n--------\nName of member %s ", m.name.GetString());
-          
-          if(m.value.IsString() ) {
-            printf("\nValue of member %s ", m.value.GetString() );
-            builder.type(ValueType::String)
-                   .value(string(m.value.GetString()));
-          }
-              
-          if(m.value.IsInt() ) {
-              printf("\nValue of member %i ", m.value.GetInt() );
-              builder.type(ValueType::Int)
-                   .value(m.value.GetInt());
-          }
-             
-          if(m.value.IsDouble() ) {
-            printf("\nValue of member %f ", m.value.GetDouble() );
-            builder.type(ValueType::Number)
-                   .value(m.value.GetDouble());
-          }
-              
-          printf("\n");
 
-        }
+  /// Removes the city nodes of idle countries. A country node is removed with its cities and recreated empty.
+  void evict_catalog()
+  {
+    for (const auto& country : catalog_tree_.evict(CatalogTree::Clock::now(), config_.catalog_idle)) {
+      responder_.remove_node(NodePath("/catalog") / NodePath(country), [this, country](const std::error_code& ec) {
+        catalog_tree_.evicted(country);
+        if (ec) return;
+        NodeBuilder builder{"/catalog"};
+        builder.make_node(country).display_name(country);
         responder_.add_node( move(builder),
           bind(&OpenWeatherDataLink::nodes_created, this, placeholders::_1, placeholders::_2)
         );
+      });
+    }
+    link_.schedule_timed_task(chrono::minutes(1), [this]() { this->evict_catalog(); });
+  }
+
+
+  /// Writes the snapshot if an observation changed since the last one and schedules the next.
+  void snapshot()
+  {
+    save_snapshot_if_changed();
+    link_.schedule_timed_task(config_.snapshot_interval, [&]() { this->snapshot(); });
+  }
+
+
+  void save_snapshot_if_changed()
+  {
+    if (config_.snapshot_file.empty()) return;
+
+    auto version = observations_.version();
+    if (version != snapshot_version_ && save_snapshot(config_.snapshot_file, observations_.all())) {
+      snapshot_version_ = version;
+    }
+  }
+
+  
+
+  /// Starts a poll cycle of an endpoint: queues a request for every location that is due for the fetch stage. The
+  /// responses go through the parse stage, the cycle ends when the last of them is processed, then the changed values
+  /// are published as one batch and the scheduler arms the next poll. Locations with subscribers are polled every
+  /// interval, the others only every background interval. While disconnected the observations go to the spill. Runs
+  /// on a link thread and never waits for a stage.
+  /// @param task The scheduler task of the endpoint.
+  void poll(Endpoint& endpoint, Scheduler::Task task) {
+    TraceCycle trace;
+    TraceSpan poll_span("poll", endpoint.name());
+
+    auto& polled = endpoint.polled();
+    polled.resize(config_.locations.size());
+    auto now = chrono::steady_clock::now();
+
+    auto cycle = make_shared<PollCycle>();
+    cycle->endpoint_ = &endpoint;
+    cycle->task_ = task;
+    cycle->traced_ = Trace::sampled();
+    // Held by the poll itself until all requests are queued, so the cycle cannot end in between.
+    cycle->pending_ = 1;
+
+    // While the broker does not keep up, polling would only add values to coalesce, the poll is skipped. Its end
+    // still flushes, which sends the coalesced values once the budget allows it. While disconnected the values go to
+    // the spill, the confirmations of the previous connection do not hold it back.
+    bool saturated = !disconnected_ && publisher_.saturated();
+    if (saturated) {
+      ++metrics_.polls_deferred_;
+    }
+
+    for (size_t i = 0; i < config_.locations.size() && !saturated; ++i) {
+      bool due = config_.background_interval.count() == 0 || subscriptions_.subscribed(i) ||
+                 polled[i] == chrono::steady_clock::time_point() || now - polled[i] >= config_.background_interval;
+      if (!due) {
+        ++cycle->skipped_;
+        continue;
+      }
+
+      ++cycle->pending_;
+      if (!fetch_queue_.try_push(FetchJob{cycle, i})) {
+        // Retried with the next poll, the location keeps its old poll time.
+        --cycle->pending_;
+        ++metrics_.queue_full_;
+        continue;
+      }
+      polled[i] = now;
+    }
+    finish(cycle);
+  }
+
+
+  /// Runs the API requests of the queued locations and hands the responses to the parse stage.
+  void fetch_worker()
+  {
+    FetchJob job;
+    while (fetch_queue_.pop(job)) {
+      fetch(job);
+      job.cycle_.reset();
+    }
+  }
+
+
+  void fetch(const FetchJob& job)
+  {
+    if (stopping_) {
+      finish(job.cycle_);
+      return;
+    }
+
+    TraceCycle trace(job.cycle_->traced_);
+    const auto& endpoint = *job.cycle_->endpoint_;
+    const auto& location = config_.locations[job.location_];
+
+    auto parse = make_shared<ParseJob>(ParseJob{job.cycle_, job.location_, take_buffer(), 0});
+    string error;
+    Fetcher::Timing timing;
+    ++metrics_.requests_;
+    bool fetched_ok;
+    {
+      TraceSpan span("fetch", location.path_);
+      fetched_ok = fetcher_.get(endpoint.url(location, config_.api_key), parse->body_, error, timing);
+    }
+    record_timing(timing);
+    if (!fetched_ok) {
+      ++metrics_.request_errors_;
+      LOG_EFM_ERROR(responder_error_code::curl_error, "Failed to GET " << endpoint.name() << " of " << location.path_ << ": " << error);
+      return_buffer(move(parse->body_));
+      finish(job.cycle_);
+      return;
+    }
+
+    parse->fetched_ = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    if (recorder_.is_open()) {
+      record(endpoint, location, parse->fetched_, timing, parse->body_);
+    }
+    // Waits while the parse stage is behind, which holds back further requests.
+    if (!parse_pool_->submit([this, parse]() { this->parse(*parse); })) {
+      finish(job.cycle_);
+    }
+  }
+
+
+  /// Parses a fetched response on the parse stage and ends its part of the poll cycle.
+  void parse(ParseJob& job)
+  {
+    process(job);
+    return_buffer(move(job.body_));
+    finish(job.cycle_);
+    job.cycle_.reset();
+  }
+
+
+  void process(const ParseJob& job)
+  {
+    TraceCycle trace(job.cycle_->traced_);
+    auto& endpoint = *job.cycle_->endpoint_;
+    const auto& location = config_.locations[job.location_];
+
+    auto start = chrono::steady_clock::now();
+    sink_time = 0;
+    bool processed;
+    {
+      TraceSpan span("process", location.path_);
+      processed = endpoint.process(location, job.body_, job.fetched_, *this);
+    }
+    metrics_.parse_.record(microseconds_since(start) - sink_time);
+    if (!processed) {
+      ++metrics_.parse_errors_;
+      LOG_EFM_ERROR(responder_error_code::endpoint_error, endpoint.name() << " of " << location.path_ << ": invalid response");
+    }
+  }
+
+
+  /// Ends a part of a poll cycle. The last one publishes the batch of the cycle and hands the endpoint back to the
+  /// scheduler for its next poll, so the polls of an endpoint never overlap.
+  void finish(const shared_ptr<PollCycle>& cycle)
+  {
+    if (--cycle->pending_ > 0) return;
+
+    TraceCycle trace(cycle->traced_);
+    publisher_.flush();
+    auto& endpoint = *cycle->endpoint_;
+    LOG_EFM_DEBUG("OpenWeatherDataLink", DebugLevel::l2,
+      "polled " << endpoint.name() << ", " << cycle->skipped_ << " unsubscribed locations skipped");
+    scheduler_.done(cycle->task_);
+  }
+
+
+  /// Returns an empty response buffer, one which already grew to the size of a response if there is one.
+  string take_buffer()
+  {
+    lock_guard<mutex> lock(buffers_mutex_);
+    if (buffers_.empty()) {
+      return string();
+    }
+    string buffer = move(buffers_.back());
+    buffers_.pop_back();
+    return buffer;
+  }
+
+
+  void return_buffer(string&& buffer)
+  {
+    buffer.clear();
+    lock_guard<mutex> lock(buffers_mutex_);
+    buffers_.push_back(move(buffer));
+  }
+
+
+  /// Appends a response to the recording for the replay tool.
+  void record(const Endpoint& endpoint, const Location& location, int64_t fetched, const Fetcher::Timing& timing,
+    const string& body)
+  {
+    Recording recording;
+    recording.endpoint_ = endpoint.name();
+    recording.location_ = location;
+    recording.fetched_ = fetched;
+    recording.fetch_time_ = timing.total_;
+    recording.body_ = body;
+    if (!recorder_.write(recording)) {
+      LOG_EFM_ERROR(responder_error_code::recording_error, "could not write " << config_.record_file);
+    }
+  }
+
+
+  void record_timing(const Fetcher::Timing& timing)
+  {
+    // Phases which did not take place, e.g. the connect of a reused connection, are not recorded.
+    if (timing.dns_ > 0) metrics_.dns_.record(timing.dns_);
+    if (timing.connect_ > 0) metrics_.connect_.record(timing.connect_);
+    if (timing.tls_ > 0) metrics_.tls_.record(timing.tls_);
+    if (timing.first_byte_ > 0) metrics_.first_byte_.record(timing.first_byte_);
+    if (timing.total_ > 0) metrics_.fetch_.record(timing.total_);
+  }
+
+
+  /// Publishes the histograms of the last interval and the counters below /metrics and schedules the next update.
+  void publish_metrics()
+  {
+    auto now = chrono::system_clock::now();
+    auto number = [](const char* name, double value) {
+      ObservationValue result;
+      result.name_ = name;
+      result.type_ = ObservationValue::Number;
+      result.number_ = value;
+      return result;
+    };
+    auto integer = [](const char* name, uint64_t value) {
+      ObservationValue result;
+      result.name_ = name;
+      result.type_ = ObservationValue::Int;
+      result.int_ = static_cast<int64_t>(value);
+      return result;
+    };
+
+    for (const auto& entry : metrics_.histograms()) {
+      auto summary = entry.histogram_->collect();
+      Observation observation;
+      observation.path_ = value_path(metrics_path_, entry.name_);
+      observation.values_ = {
+        number("p50", summary.p50_ * entry.scale_), number("p95", summary.p95_ * entry.scale_),
+        number("p99", summary.p99_ * entry.scale_), number("max", summary.max_ * entry.scale_),
+        integer("count", summary.count_)};
+      observation_publisher_.publish(observation, now, Subscriptions::npos);
+    }
+
+    Observation counters;
+    counters.path_ = metrics_path_;
+    counters.values_ = {
+      integer("requests", metrics_.requests_), integer("request_errors", metrics_.request_errors_),
+      integer("parse_errors", metrics_.parse_errors_), integer("queue_full", metrics_.queue_full_),
+      integer("published", publisher_.sent()), integer("publish_in_flight", publisher_.in_flight()),
+      integer("publish_deferred", publisher_.deferred()), integer("polls_deferred", metrics_.polls_deferred_),
+      integer("publish_errors", publisher_.failed()), integer("log_dropped", log_.dropped()),
+      integer("spilled", metrics_.spilled_), integer("replayed", metrics_.replayed_),
+      integer("spill_dropped", spill_ ? spill_->dropped() : 0)};
+    observation_publisher_.publish(counters, now, Subscriptions::npos);
+    publisher_.flush();
+
+    link_.schedule_timed_task(config_.metrics_interval, [this]() { this->publish_metrics(); });
+  }
+
+
+  void received(const Location& location, const string& body, int64_t observed) override
+  {
+    SinkTimer timer;
+    // The OpenWeatherData node shows the raw response of the default location.
+    if (location.path_ == "/") {
+      publisher_.set_value(owd_node_, Variant{body}, chrono::system_clock::time_point(chrono::milliseconds(observed)));
+    }
+    log_.dump(location.path_.c_str(), body);
+  }
+
+
+  bool publish(const Observation& result) override
+  {
+    SinkTimer timer;
+    TraceSpan span("publish", result.path_);
+    Observation observation = result;
+    if (!observation_publisher_.accept(observation)) {
+      return false;
+    }
+    // Kept for the broker until the link is connected again, if the spill fails it is published as before.
+    if (disconnected_ && spill_ && spill_->append(observation)) {
+      ++metrics_.spilled_;
+      return true;
+    }
+    observation_publisher_.publish(observation, chrono::system_clock::time_point(chrono::milliseconds(observation.observed_)),
+      subscriptions_.find(observation.path_));
+    return true;
+  }
+
+
+  void publish(const Location& location, const Forecast& forecast) override
+  {
+    SinkTimer timer;
+    TraceSpan span("publish forecast", location.path_);
+    forecasts_.update(location.path_, forecast);
+    {
+      lock_guard<mutex> lock(forecast_streams_mutex_);
+      if (none_of(forecast_streams_.begin(), forecast_streams_.end(),
+            [&location](const pair<MutableActionResultStreamPtr, string>& entry) { return entry.second == location.path_; })) {
+        return;
+      }
+    }
+    // The streams belong to the link, they are only touched on its threads and not on the parse stage.
+    auto path = location.path_;
+    auto copy = make_shared<Forecast>(forecast);
+    link_.schedule_task([this, path, copy]() { this->refresh_forecast_streams(path, *copy); });
+  }
 
+
+  /// Sends a new forecast to all open Get Forecast tables of its location. Runs on a link thread.
+  void refresh_forecast_streams(const string& path, const Forecast& forecast)
+  {
+    vector<MutableActionResultStreamPtr> streams;
+    {
+      lock_guard<mutex> lock(forecast_streams_mutex_);
+      for (const auto& entry : forecast_streams_) {
+        if (entry.second == path) {
+          streams.push_back(entry.first);
+        }
       }
-     
+    }
 
-      link_.schedule_timed_task(std::chrono::seconds(60), [&]() { this->getWeatherData(); });
+    for (const auto& stream : streams) {
+      if (stream->is_closed()) continue;
+      auto& table = stream->get_result_table();
+      table.set_mode(ActionStreamingMode::Refresh);
+      add_forecast_rows(table, forecast);
+      stream->commit();
     }
   }
 
@@ -198,7 +742,54 @@ public:
     if (!ec) {
       disconnected_ = false;
       LOG_EFM_INFO(responder_error_code::connected);
-      link_.schedule_timed_task(std::chrono::seconds(1), [&]() { this->getWeatherData(); });  
+      // The confirmations of values set on the previous connection may never come.
+      publisher_.reset_in_flight();
+      // Only arms the endpoints which are neither waiting for their next poll nor polling.
+      scheduler_.resume();
+      if (spill_ && spill_->size() > 0 && !replaying_.exchange(true)) {
+        link_.schedule_task([this]() { this->replay_spill(); });
+      }
+    }
+  }
+
+
+  /// Sends a chunk of the spilled observations with the time they were observed and schedules the next one, until
+  /// the spill is empty. A chunk is only sent while less than half of the publish budget is in use, so the values of
+  /// the polls always find room next to it. At the end the latest observations are published again, as a replayed
+  /// value may have overwritten a newer one of the same node.
+  void replay_spill()
+  {
+    if (disconnected_) {
+      replaying_ = false;
+      // connected() does not start a replay while this one runs, it carries on if the link reconnected in between.
+      if (disconnected_ || replaying_.exchange(true)) return;
+    }
+
+    if (config_.publish_budget > 0 && publisher_.in_flight() >= config_.publish_budget / 2) {
+      link_.schedule_timed_task(chrono::milliseconds(100), [this]() { this->replay_spill(); });
+      return;
+    }
+
+    vector<Observation> observations;
+    if (spill_->read(observations, replay_chunk) > 0) {
+      observation_publisher_.replay(observations);
+      metrics_.replayed_ += observations.size();
+      link_.schedule_task([this]() { this->replay_spill(); });
+      return;
+    }
+
+    for (const auto& observation : observations_.all()) {
+      observation_publisher_.publish(observation, chrono::system_clock::time_point(chrono::milliseconds(observation.observed_)),
+        subscriptions_.find(observation.path_));
+    }
+    publisher_.flush();
+    LOG_EFM_INFO(responder_error_code::spill_replayed,
+      metrics_.replayed_.load() << " in total, " << spill_->dropped() << " dropped");
+    replaying_ = false;
+    // An observation spilled after the last chunk was read is not left behind. Retried after a pause, so a spill
+    // which reports observations it cannot read does not keep the link busy.
+    if (!disconnected_ && spill_->size() > 0 && !replaying_.exchange(true)) {
+      link_.schedule_timed_task(chrono::seconds(1), [this]() { this->replay_spill(); });
     }
   }
 
@@ -207,6 +798,10 @@ public:
   {
     LOG_EFM_INFO(responder_error_code::disconnected, ec.message());
     disconnected_ = true;
+    // With a spill the polls go on, their observations are kept for the broker.
+    if (!spill_) {
+      scheduler_.pause();
+    }
   }
 
   void set_text(const Variant& value)
@@ -250,19 +845,330 @@ public:
   }
 
  
+  void get_history_called(
+    const MutableActionResultStreamPtr& stream,
+    const NodePath& parent_path,
+    const Variant& params,
+    const std::error_code& ec)
+  {
+    (void)parent_path;
+    if (ec) return;
+
+    const auto* path = params.get("Path");
+    const auto* range = params.get("Timerange");
+    const auto* resolution_param = params.get("Resolution");
+    int64_t from, to;
+    if (!path || path->type() != Variant::String ||
+        !parse_time_range(range && range->type() == Variant::String ? range->as_string() : string(), from, to)) {
+      LOG_EFM_ERROR(responder_error_code::history_query, (path ? *path : Variant{}) << " " << (range ? *range : Variant{}));
+      stream->set_result(UniqueActionResultPtr{new ActionTableResult{ActionError}});
+      stream->close();
+      return;
+    }
+
+    int resolution = HistoryStore::auto_resolution;
+    if (resolution_param && resolution_param->type() == Variant::String) {
+      const auto& name = resolution_param->as_string();
+      if (name == "raw") {
+        resolution = HistoryStore::raw_resolution;
+      }
+      for (size_t level = 0; level < sizeof(rollup_levels) / sizeof(rollup_levels[0]); ++level) {
+        if (name == rollup_levels[level].name_) {
+          resolution = static_cast<int>(level);
+        }
+      }
+    }
+
+    vector<HistoryRow> rows;
+    history_.query(path->as_string(), from, to, resolution, rows);
+
+    send_table(stream, rows.size(), [&rows](ActionTableResult& table, size_t i) {
+      table.next_row()
+        .add_value(format_time(rows[i].timestamp_))
+        .add_value(rows[i].value_)
+        .add_value(rows[i].min_)
+        .add_value(rows[i].max_)
+        .add_value(rows[i].last_);
+    });
+  }
+
+
+  void find_nearest_city_called(
+    const MutableActionResultStreamPtr& stream,
+    const NodePath& parent_path,
+    const Variant& params,
+    const std::error_code& ec)
+  {
+    (void)parent_path;
+    if (ec) return;
+
+    // One "lat,lon" pair per line or separated by ';', so a whole fleet can be resolved with one invocation.
+    const auto* input = params.get("Coordinates");
+    vector<pair<double, double>> positions;
+    if (input && input->type() == Variant::String) {
+      const auto& text = input->as_string();
+      char separator = text.find(';') == string::npos ? '\n' : ';';
+      istringstream lines(text);
+      string line;
+      while (getline(lines, line, separator)) {
+        double latitude, longitude;
+        char comma;
+        istringstream fields(line);
+        if (fields >> latitude >> comma >> longitude && comma == ',') {
+          positions.emplace_back(latitude, longitude);
+        }
+      }
+    }
+    if (positions.empty() || city_index_.size() == 0) {
+      LOG_EFM_ERROR(responder_error_code::city_query, (input ? *input : Variant{}));
+      stream->set_result(UniqueActionResultPtr{new ActionTableResult{ActionError}});
+      stream->close();
+      return;
+    }
+
+    send_table(stream, positions.size(), [this, &positions](ActionTableResult& table, size_t i) {
+      double distance;
+      const City* city = city_index_.nearest(positions[i].first, positions[i].second, distance);
+      table.next_row()
+        .add_value(positions[i].first)
+        .add_value(positions[i].second)
+        .add_value(static_cast<int64_t>(city->id_))
+        .add_value(cities_.name(*city))
+        .add_value(CityTable::country(*city))
+        .add_value(distance);
+    });
+  }
+
+
+  void find_cities_in_box_called(
+    const MutableActionResultStreamPtr& stream,
+    const NodePath& parent_path,
+    const Variant& params,
+    const std::error_code& ec)
+  {
+    (void)parent_path;
+    if (ec) return;
+
+    double bounds[4];
+    const char* const names[4] = {"South", "West", "North", "East"};
+    for (int i = 0; i < 4; ++i) {
+      const auto* value = params.get(names[i]);
+      if (!value || (value->type() != Variant::Double && value->type() != Variant::Int)) {
+        LOG_EFM_ERROR(responder_error_code::city_query, names[i] << " missing");
+        stream->set_result(UniqueActionResultPtr{new ActionTableResult{ActionError}});
+        stream->close();
+        return;
+      }
+      bounds[i] = value->type() == Variant::Double ? value->as_double() : static_cast<double>(value->as_int());
+    }
+
+    vector<const City*> found;
+    city_index_.within(bounds[0], bounds[1], bounds[2], bounds[3], found);
+
+    send_table(stream, found.size(), [this, &found](ActionTableResult& table, size_t i) {
+      table.next_row()
+        .add_value(static_cast<int64_t>(found[i]->id_))
+        .add_value(cities_.name(*found[i]))
+        .add_value(CityTable::country(*found[i]))
+        .add_value(static_cast<double>(found[i]->latitude_))
+        .add_value(static_cast<double>(found[i]->longitude_));
+    });
+  }
+
+
+  void get_forecast_called(
+    const MutableActionResultStreamPtr& stream,
+    const NodePath& parent_path,
+    const Variant& params,
+    const std::error_code& ec)
+  {
+    (void)parent_path;
+    if (ec) return;
+
+    const auto* path_param = params.get("Path");
+    string path = path_param && path_param->type() == Variant::String && !path_param->as_string().empty()
+      ? path_param->as_string()
+      : string("/");
+
+    // The table stays open and is refreshed whenever a new forecast of the location has been fetched.
+    auto* table = new ActionTableResult{ActionSuccess};
+    table->set_mode(ActionStreamingMode::Refresh);
+    UniqueActionResultPtr result{table};
+    Forecast forecast;
+    if (forecasts_.get(path, forecast)) {
+      add_forecast_rows(*table, forecast);
+    }
+
+    // An open table counts as subscriber of its location, so the location keeps being polled.
+    size_t location = subscriptions_.find(path);
+    subscriptions_.changed(location, true);
+    // The handler must not hold the stream, the stream holds the handler.
+    const auto* closed = stream.get();
+    stream->set_close_handler([this, closed, location](const NodePath&, const std::error_code&) {
+      subscriptions_.changed(location, false);
+      lock_guard<mutex> lock(forecast_streams_mutex_);
+      forecast_streams_.erase(remove_if(forecast_streams_.begin(), forecast_streams_.end(),
+        [closed](const pair<MutableActionResultStreamPtr, string>& entry) { return entry.first.get() == closed; }),
+        forecast_streams_.end());
+    });
+    stream->set_result(move(result));
+
+    // Only refreshed once it has its table. A stream which was closed right away already ran its close handler.
+    lock_guard<mutex> lock(forecast_streams_mutex_);
+    if (!stream->is_closed()) {
+      forecast_streams_.emplace_back(stream, path);
+    }
+  }
+
+
+  /// Writes the recorded trace spans to a file in the Chrome trace-event format.
+  void export_trace_called(
+    const MutableActionResultStreamPtr& stream,
+    const NodePath& parent_path,
+    const Variant& params,
+    const std::error_code& ec)
+  {
+    (void)parent_path;
+    if (ec) return;
+
+    const auto* file_param = params.get("File");
+    string file = file_param && file_param->type() == Variant::String && !file_param->as_string().empty()
+      ? file_param->as_string()
+      : string("trace.json");
+
+    string json;
+    size_t spans = Trace::export_chrome_json(json);
+    FILE* output = fopen(file.c_str(), "wb");
+    bool written = output && fwrite(json.data(), 1, json.size(), output) == json.size();
+    if (output && fclose(output) != 0) {
+      written = false;
+    }
+    if (!written) {
+      LOG_EFM_ERROR(responder_error_code::trace_error, "could not write " << file);
+      stream->set_result(UniqueActionResultPtr{new ActionValuesResult{
+        ActionValuesResult(ActionError).add_value(static_cast<int64_t>(0)).add_value(file)}});
+      return;
+    }
+    stream->set_result(UniqueActionResultPtr{new ActionValuesResult{
+      ActionValuesResult(ActionSuccess).add_value(static_cast<int64_t>(spans)).add_value(file)}});
+  }
+
+
   void on_subscribe_json(bool subscribe) {
     if (subscribe) 
       LOG_EFM_INFO(responder_error_code::subscribed_text);
     else 
       LOG_EFM_INFO(responder_error_code::unsubscribed_text);
+    subscriptions_.changed(subscriptions_.find("/OpenWeatherData"), subscribe);
   }
 
 private:
+  /// Sends a table result in chunks of rows, so large results do not end up in one huge message, and closes the
+  /// stream.
+  /// @param stream The stream of the action.
+  /// @param rows The number of rows.
+  /// @param add_row Called with the table and the row index to add each row.
+  template <typename AddRow>
+  static void send_table(const MutableActionResultStreamPtr& stream, size_t rows, AddRow add_row)
+  {
+    const size_t chunk = 500;
+    size_t i = 0;
+    do {
+      ActionTableResult* table;
+      UniqueActionResultPtr result;
+      if (i == 0) {
+        table = new ActionTableResult{ActionSuccess};
+        table->set_mode(ActionStreamingMode::Refresh);
+        result.reset(table);
+      } else {
+        table = &stream->get_result_table();
+        table->set_mode(ActionStreamingMode::Append);
+      }
+
+      for (size_t end = min(i + chunk, rows); i < end; ++i) {
+        add_row(*table, i);
+      }
+
+      if (result) {
+        stream->set_result(move(result));
+      } else {
+        stream->commit();
+      }
+    } while (i < rows);
+
+    stream->close();
+  }
+
+  static void add_forecast_rows(ActionTableResult& table, const Forecast& forecast)
+  {
+    for (size_t i = 0; i < forecast.count_; ++i) {
+      const auto& entry = forecast.entries_[i];
+      table.next_row()
+        .add_value(format_time(entry.timestamp_))
+        .add_value(static_cast<double>(entry.temperature_))
+        .add_value(static_cast<double>(entry.feels_like_))
+        .add_value(static_cast<double>(entry.temperature_min_))
+        .add_value(static_cast<double>(entry.temperature_max_))
+        .add_value(static_cast<double>(entry.pressure_))
+        .add_value(static_cast<double>(entry.humidity_))
+        .add_value(static_cast<double>(entry.clouds_))
+        .add_value(static_cast<double>(entry.wind_speed_))
+        .add_value(static_cast<double>(entry.wind_direction_))
+        .add_value(static_cast<double>(entry.precipitation_probability_))
+        .add_value(static_cast<double>(entry.precipitation_))
+        .add_value(string(entry.description_));
+    }
+  }
+
+  static shared_ptr<HistorySegments> make_segments(const WeatherConfig& config)
+  {
+    if (config.history_dir.empty()) {
+      return nullptr;
+    }
+    HistorySegments::Settings settings;
+    settings.directory_ = config.history_dir;
+    settings.segment_bytes_ = config.history_segment_mb * 1024 * 1024;
+    settings.segment_duration_ = config.history_segment_duration;
+    settings.retention_ = chrono::duration_cast<chrono::milliseconds>(config.history_retention).count();
+    return make_shared<HistorySegments>(settings);
+  }
+
+  AsyncLog log_;
+  Metrics metrics_;
   Link& link_;
   Responder& responder_;
+  WeatherConfig config_;
+  shared_ptr<HistorySegments> segments_;
+  HistoryStore history_;
+  ObservationStore observations_;
+  CityTable cities_;
+  CityIndex city_index_;
+  CatalogTree catalog_tree_;
+  ForecastStore forecasts_;
+  mutex forecast_streams_mutex_;
+  vector<pair<MutableActionResultStreamPtr, string>> forecast_streams_;
+  uint64_t snapshot_version_{0};
+  Subscriptions subscriptions_;
+  ResponderSink responder_sink_;
+  Publisher publisher_;
+  ObservationPublisher observation_publisher_;
+  Fetcher fetcher_;
+  Recorder recorder_;
+  vector<unique_ptr<Endpoint>> endpoints_;
+  BoundedQueue<FetchJob> fetch_queue_;
+  mutex buffers_mutex_;
+  vector<string> buffers_; ///< Response buffers of finished jobs, they keep their capacity.
+  atomic<bool> stopping_{false};
+  unique_ptr<ParsePool> parse_pool_;
+  unique_ptr<Stage> fetch_stage_;
+  Scheduler scheduler_;
   NodePath text_path_{"/text"};
   NodePath OWDPath{"/OpenWeatherData"};
-  bool disconnected_{true};
+  Publisher::Handle owd_node_;
+  string metrics_path_{"/metrics"};
+  unique_ptr<Spill> spill_;
+  atomic<bool> disconnected_{true};
+  atomic<bool> replaying_{false};   ///< Whether replay_spill() is scheduled.
 };
 
 
@@ -273,11 +1179,15 @@ int main(int argc, char* argv[])
   
   if (!options.parse(argc, argv, std::cerr)) return EXIT_FAILURE;
   
+  WeatherConfig config;
+  if (!config.load("weather.json")) return EXIT_FAILURE;
+  LogLevel log_level = options.log_level();
+
   curl_global_init(CURL_GLOBAL_DEFAULT);
   Link link(move(options), LinkType::Responder);
   LOG_EFM_INFO(::responder_error_code::build_with_version, link.get_version_info());
 
-  OpenWeatherDataLink responder_link(link);
+  OpenWeatherDataLink responder_link(link, config, log_level);
 
   link.set_on_initialized_handler( bind(&OpenWeatherDataLink::initialize, &responder_link, placeholders::_1, placeholders::_2 ) );
   link.set_on_connected_handler( bind(&OpenWeatherDataLink::connected, &responder_link, placeholders::_1 ) );
@@ -285,5 +1195,7 @@ int main(int argc, char* argv[])
 
   link.run();
 
+  responder_link.save_snapshot_if_changed();
+
   return EXIT_SUCCESS;
 }
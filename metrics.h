@@ -0,0 +1,49 @@
+/// @file metrics.h
+
+#pragma once
+
+#include "histogram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+/// @brief The self metrics of the link, published below /metrics. Thread safe.
+/// Durations are recorded in µs, queue depths in entries.
+struct Metrics
+{
+  Histogram dns_;         ///< Time from the start of a request until the name was resolved.
+  Histogram connect_;     ///< Time from the start of a request until the connection was established.
+  Histogram tls_;         ///< Time from the start of a request until the TLS handshake was done, HTTPS only.
+  Histogram first_byte_;  ///< Time from the start of a request until the first byte of the response.
+  Histogram fetch_;       ///< Total time of a request.
+  Histogram parse_;       ///< Time to parse a response.
+  Histogram publish_;     ///< Time to hand a batch of values to the responder.
+  Histogram queue_depth_; ///< Values waiting in the publisher when a batch is sent.
+
+  std::atomic<uint64_t> requests_{0};       ///< Requests made.
+  std::atomic<uint64_t> request_errors_{0}; ///< Requests which failed or had a status other than 200.
+  std::atomic<uint64_t> parse_errors_{0};   ///< Responses which could not be parsed.
+  std::atomic<uint64_t> queue_full_{0};     ///< Requests not queued because the fetch stage was behind.
+  std::atomic<uint64_t> polls_deferred_{0}; ///< Polls skipped because the publisher used up its budget.
+  std::atomic<uint64_t> spilled_{0};        ///< Observations written to the spill while disconnected.
+  std::atomic<uint64_t> replayed_{0};       ///< Spilled observations sent after the reconnect.
+
+  /// A histogram and how it is published.
+  struct Entry
+  {
+    const char* name_; ///< Node name below /metrics.
+    Histogram* histogram_;
+    double scale_;     ///< Factor from the recorded unit to the published one.
+  };
+
+  /// Returns the histograms with their node names, durations are published in ms.
+  /// @return The histograms.
+  std::vector<Entry> histograms()
+  {
+    return {{"dns", &dns_, 0.001}, {"connect", &connect_, 0.001}, {"tls", &tls_, 0.001},
+            {"first_byte", &first_byte_, 0.001}, {"fetch", &fetch_, 0.001}, {"parse", &parse_, 0.001},
+            {"publish", &publish_, 0.001}, {"queue_depth", &queue_depth_, 1}};
+  }
+};
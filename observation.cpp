@@ -0,0 +1,296 @@
+#include "observation.h"
+#include "rapidjson/reader.h"
+
+#include <cstring>
+
+using namespace rapidjson;
+
+
+namespace
+{
+/// Base of the SAX handlers which turn a response into an Observation. Tracks the nesting and the current key, the
+/// derived handler decides which objects hold values.
+template <typename Derived>
+class ObservationHandler : public BaseReaderHandler<UTF8<>, Derived>
+{
+public:
+  explicit ObservationHandler(Observation& observation)
+    : observation_(observation)
+  {
+  }
+
+  bool StartObject()
+  {
+    ++depth_;
+    return true;
+  }
+
+  bool EndObject(SizeType)
+  {
+    --depth_;
+    return true;
+  }
+
+  bool StartArray()
+  {
+    ++depth_;
+    return true;
+  }
+
+  bool EndArray(SizeType)
+  {
+    --depth_;
+    return true;
+  }
+
+  bool Key(const char* str, SizeType length, bool)
+  {
+    key_.assign(str, length);
+    return true;
+  }
+
+  bool Int(int i)
+  {
+    return static_cast<Derived*>(this)->integer(i);
+  }
+  bool Uint(unsigned u)
+  {
+    return static_cast<Derived*>(this)->integer(u);
+  }
+  bool Int64(int64_t i)
+  {
+    return static_cast<Derived*>(this)->number(static_cast<double>(i));
+  }
+  bool Uint64(uint64_t u)
+  {
+    return static_cast<Derived*>(this)->number(static_cast<double>(u));
+  }
+  bool Double(double d)
+  {
+    return static_cast<Derived*>(this)->number(d);
+  }
+
+  bool Default()
+  {
+    return true;
+  }
+
+protected:
+  void add(ObservationValue::Type type, int64_t i, double d, const char* str, SizeType length)
+  {
+    ObservationValue value;
+    value.name_ = key_;
+    value.type_ = type;
+    value.int_ = i;
+    value.number_ = d;
+    if (str) {
+      value.string_.assign(str, length);
+    }
+    observation_.values_.push_back(std::move(value));
+  }
+
+  Observation& observation_;
+  int depth_{0};
+  std::string key_;
+};
+
+
+/// {"dt": 1551201544, "main": {"temp": 281.5, "pressure": 1031, ...}, ...}, every member of "main" is a value.
+class WeatherHandler : public ObservationHandler<WeatherHandler>
+{
+public:
+  using ObservationHandler::ObservationHandler;
+
+  bool StartObject()
+  {
+    if (depth_++ == 1) {
+      in_main_ = key_ == "main";
+      found_ = found_ || in_main_;
+    }
+    return true;
+  }
+
+  bool EndObject(SizeType)
+  {
+    if (--depth_ == 1) {
+      in_main_ = false;
+    }
+    return true;
+  }
+
+  bool String(const char* str, SizeType length, bool)
+  {
+    if (in_main_ && depth_ == 2) {
+      add(ObservationValue::String, 0, 0, str, length);
+    }
+    return true;
+  }
+
+  bool integer(int64_t value)
+  {
+    if (depth_ == 1 && key_ == "dt") {
+      observation_.observed_ = value * 1000;
+    } else if (in_main_ && depth_ == 2) {
+      add(ObservationValue::Int, value, 0, nullptr, 0);
+    }
+    return true;
+  }
+
+  bool number(double value)
+  {
+    if (depth_ == 1 && key_ == "dt") {
+      observation_.observed_ = static_cast<int64_t>(value) * 1000;
+    } else if (in_main_ && depth_ == 2) {
+      add(ObservationValue::Number, 0, value, nullptr, 0);
+    }
+    return true;
+  }
+
+  bool found_{false};
+
+private:
+  bool in_main_{false};
+};
+
+
+/// {"list": [{"dt": 1606147200, "main": {"aqi": 2}, "components": {"co": 201.94, "no2": 0.77, ...}}]}, the air
+/// quality index and every component of the first list entry is a value.
+class AirPollutionHandler : public ObservationHandler<AirPollutionHandler>
+{
+public:
+  using ObservationHandler::ObservationHandler;
+
+  bool StartArray()
+  {
+    if (depth_++ == 1) {
+      in_list_ = key_ == "list";
+    }
+    return true;
+  }
+
+  bool EndArray(SizeType)
+  {
+    if (--depth_ == 1) {
+      in_list_ = false;
+    }
+    return true;
+  }
+
+  bool StartObject()
+  {
+    ++depth_;
+    if (depth_ == 3 && in_list_) {
+      ++entries_;
+    } else if (depth_ == 4 && in_list_ && entries_ == 1) {
+      section_ = key_ == "main" ? Main : key_ == "components" ? Components : None;
+    }
+    return true;
+  }
+
+  bool EndObject(SizeType)
+  {
+    if (depth_-- == 4) {
+      section_ = None;
+    }
+    return true;
+  }
+
+  bool String(const char*, SizeType, bool)
+  {
+    return true;
+  }
+
+  bool integer(int64_t value)
+  {
+    if (depth_ == 3 && in_list_ && entries_ == 1 && key_ == "dt") {
+      observation_.observed_ = value * 1000;
+    } else if (section_ == Main && key_ == "aqi") {
+      add(ObservationValue::Int, value, 0, nullptr, 0);
+      found_ = true;
+    } else if (section_ == Components) {
+      add(ObservationValue::Number, 0, static_cast<double>(value), nullptr, 0);
+    }
+    return true;
+  }
+
+  bool number(double value)
+  {
+    if (depth_ == 3 && in_list_ && entries_ == 1 && key_ == "dt") {
+      observation_.observed_ = static_cast<int64_t>(value) * 1000;
+    } else if (section_ == Components) {
+      add(ObservationValue::Number, 0, value, nullptr, 0);
+    }
+    return true;
+  }
+
+  bool found_{false};
+
+private:
+  enum Section
+  {
+    None,
+    Main,
+    Components
+  };
+
+  bool in_list_{false};
+  size_t entries_{0};
+  Section section_{None};
+};
+}
+
+
+bool parse_observation(const std::string& json, Observation& observation)
+{
+  WeatherHandler handler(observation);
+  Reader reader;
+  StringStream stream(json.c_str());
+  return !reader.Parse(stream, handler).IsError() && handler.found_;
+}
+
+
+bool parse_air_pollution(const std::string& json, Observation& observation)
+{
+  AirPollutionHandler handler(observation);
+  Reader reader;
+  StringStream stream(json.c_str());
+  return !reader.Parse(stream, handler).IsError() && handler.found_;
+}
+
+
+std::string value_path(const std::string& path, const std::string& name)
+{
+  return (!path.empty() && path.back() == '/') ? path + name : path + "/" + name;
+}
+
+
+bool ObservationStore::update(const Observation& observation)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& stored = observations_[observation.path_];
+  if (!stored.path_.empty() && stored.observed_ >= observation.observed_) {
+    return false;
+  }
+  stored = observation;
+  ++version_;
+  return true;
+}
+
+
+std::vector<Observation> ObservationStore::all() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Observation> result;
+  result.reserve(observations_.size());
+  for (const auto& entry : observations_) {
+    result.push_back(entry.second);
+  }
+  return result;
+}
+
+
+uint64_t ObservationStore::version() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return version_;
+}
@@ -0,0 +1,82 @@
+/// @file observation.h
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// A single value of an observation, e.g. the temperature.
+struct ObservationValue
+{
+  /// The type of the value, determines the type of its node.
+  enum Type : uint8_t
+  {
+    Int,
+    Number,
+    String
+  };
+
+  std::string name_;   ///< Name of the value and its node.
+  Type type_{Number};  ///< The type of the value.
+  int64_t int_{0};     ///< The value if type_ is Int.
+  double number_{0};   ///< The value if type_ is Number.
+  std::string string_; ///< The value if type_ is String.
+};
+
+
+/// The weather observed at one location.
+struct Observation
+{
+  std::string path_;                    ///< Node path the values are published under.
+  int64_t observed_{0};                 ///< Observation time reported by the API (dt) in ms since the epoch.
+  int64_t fetched_{0};                  ///< Time the observation was fetched in ms since the epoch.
+  std::vector<ObservationValue> values_; ///< The observed values.
+};
+
+
+/// Parses a current weather response of the OpenWeatherMap API.
+/// @param json The response body.
+/// @param observation Receives the values of the `main` object and the observation time.
+/// @return false if the response is not valid JSON or has no `main` object.
+bool parse_observation(const std::string& json, Observation& observation);
+
+/// Parses an air pollution response of the OpenWeatherMap API.
+/// @param json The response body.
+/// @param observation Receives the air quality index (`aqi`), the concentration of every component in μg/m³ and the
+/// observation time.
+/// @return false if the response is not valid JSON or has no entry.
+bool parse_air_pollution(const std::string& json, Observation& observation);
+
+/// Returns the node path of a value of an observation.
+/// @param path The node path of the observation.
+/// @param name The name of the value.
+/// @return The node path of the value.
+std::string value_path(const std::string& path, const std::string& name);
+
+
+/// @brief The latest observation of every location.
+class ObservationStore
+{
+public:
+  /// Replaces the observation of its location if it is newer, i.e. its observation time has advanced.
+  /// @param observation The new observation.
+  /// @return false if the stored observation is as new as the given one and was kept.
+  bool update(const Observation& observation);
+
+  /// Returns a copy of all observations.
+  /// @return The observations.
+  std::vector<Observation> all() const;
+
+  /// Returns a counter which is increased on every update.
+  /// @return The update counter.
+  uint64_t version() const;
+
+private:
+  mutable std::mutex mutex_;
+  std::map<std::string, Observation> observations_;
+  uint64_t version_{0};
+};
@@ -0,0 +1,156 @@
+#include "observation_publisher.h"
+
+#include <cinttypes>
+
+using namespace cisco::efm_sdk;
+
+
+namespace
+{
+/// Publisher handle of the created nodes which have no value, e.g. the node of a location.
+const Publisher::Handle no_handle = UINT32_MAX;
+
+ValueType value_type(ObservationValue::Type type)
+{
+  switch (type) {
+    case ObservationValue::Int:
+      return ValueType::Int;
+    case ObservationValue::String:
+      return ValueType::String;
+    default:
+      return ValueType::Number;
+  }
+}
+}
+
+
+ObservationPublisher::ObservationPublisher(Publisher& publisher, ValueSink& sink, ObservationStore& observations,
+  HistoryStore& history, Subscriptions& subscriptions, AsyncLog& log, NodesCreated created)
+  : publisher_(publisher), sink_(sink), observations_(observations), history_(history), subscriptions_(subscriptions)
+  , log_(log), created_(std::move(created))
+{
+}
+
+
+bool ObservationPublisher::accept(Observation& observation)
+{
+  if (observation.observed_ == 0) {
+    observation.observed_ = observation.fetched_;
+  }
+  // The API serves the same observation until the station reports again, publishing it again would only add
+  // duplicates to the history here and in downstream historians.
+  if (!observations_.update(observation)) {
+    return false;
+  }
+  for (const auto& value : observation.values_) {
+    if (value.type_ == ObservationValue::Int) {
+      history_.append(value_path(observation.path_, value.name_), observation.observed_, value.int_);
+    } else if (value.type_ == ObservationValue::Number) {
+      history_.append(value_path(observation.path_, value.name_), observation.observed_, value.number_);
+    }
+  }
+  return true;
+}
+
+
+void ObservationPublisher::publish(const Observation& observation, std::chrono::system_clock::time_point timestamp,
+  size_t location)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  create_node_locked(observation.path_);
+
+  NodeBuilder builder{observation.path_};
+  bool created = false;
+  for (const auto& value : observation.values_) {
+    switch (value.type_) {
+      case ObservationValue::Int:
+        log_.write_debug("%s/%s = %" PRId64, observation.path_.c_str(), value.name_.c_str(), value.int_);
+        break;
+      case ObservationValue::Number:
+        log_.write_debug("%s/%s = %f", observation.path_.c_str(), value.name_.c_str(), value.number_);
+        break;
+      case ObservationValue::String:
+        log_.write_debug("%s/%s = %s", observation.path_.c_str(), value.name_.c_str(), value.string_.c_str());
+        break;
+    }
+
+    auto path = value_path(observation.path_, value.name_);
+    auto inserted = published_.emplace(path, no_handle);
+    if (inserted.second) {
+      inserted.first->second = publisher_.intern(path);
+      builder.make_node(value.name_)
+        .display_name(value.name_)
+        .type(value_type(value.type_))
+        .value(variant(value))
+        .timestamp(timestamp)
+        .on_subscribe(std::bind(&Subscriptions::changed, &subscriptions_, location, std::placeholders::_1));
+      created = true;
+    } else if (inserted.first->second != no_handle) {
+      publisher_.set_value(inserted.first->second, variant(value), timestamp);
+    }
+  }
+
+  if (created) {
+    sink_.add_node(std::move(builder), NodesCreated(created_));
+  }
+}
+
+
+void ObservationPublisher::replay(const std::vector<Observation>& observations)
+{
+  std::vector<Publisher::Value> values;
+  std::vector<const Observation*> unknown;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& observation : observations) {
+      auto timestamp = std::chrono::system_clock::time_point(std::chrono::milliseconds(observation.observed_));
+      size_t first = values.size();
+      for (const auto& value : observation.values_) {
+        auto found = published_.find(value_path(observation.path_, value.name_));
+        if (found == published_.end() || found->second == no_handle) {
+          values.erase(values.begin() + first, values.end());
+          unknown.push_back(&observation);
+          break;
+        }
+        values.push_back(Publisher::Value{found->second, variant(value), timestamp});
+      }
+    }
+  }
+  publisher_.replay(std::move(values));
+  for (const auto* observation : unknown) {
+    publish(*observation, std::chrono::system_clock::time_point(std::chrono::milliseconds(observation->observed_)),
+      subscriptions_.find(observation->path_));
+  }
+  if (!unknown.empty()) {
+    publisher_.flush();
+  }
+}
+
+
+Variant ObservationPublisher::variant(const ObservationValue& value)
+{
+  switch (value.type_) {
+    case ObservationValue::Int:
+      return Variant{value.int_};
+    case ObservationValue::String:
+      return Variant{value.string_};
+    default:
+      return Variant{value.number_};
+  }
+}
+
+
+/// Creates a node and its missing parents without a value, e.g. the node of a location.
+void ObservationPublisher::create_node_locked(const std::string& path)
+{
+  if (path.empty() || path == "/" || !published_.emplace(path, no_handle).second) return;
+
+  auto separator = path.rfind('/');
+  std::string parent = separator == 0 ? std::string("/") : path.substr(0, separator);
+  std::string name = path.substr(separator + 1);
+  create_node_locked(parent);
+
+  NodeBuilder builder{parent};
+  builder.make_node(name).display_name(name);
+  sink_.add_node(std::move(builder), NodesCreated(created_));
+}
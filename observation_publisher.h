@@ -0,0 +1,83 @@
+/// @file observation_publisher.h
+
+#pragma once
+
+#include "async_log.h"
+#include "history.h"
+#include "observation.h"
+#include "publisher.h"
+#include "subscriptions.h"
+
+#include <efm_link.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+
+/// @brief Turns the observations of the endpoints into value nodes below the node of their location.
+/// accept() drops an observation whose time has not advanced and appends its numeric values to the history. publish()
+/// creates the nodes of new values through the sink and sets the values of existing nodes with the next batch of the
+/// publisher. The link and the replay tool both publish through it, so a replay measures the path of the link.
+/// Thread safe.
+class ObservationPublisher
+{
+public:
+  /// Called with the created paths or the error once nodes were added.
+  using NodesCreated = std::function<void(const std::vector<cisco::efm_sdk::NodePath>&, const std::error_code&)>;
+
+  /// Constructs a publisher for observations.
+  /// @param publisher Sends the values of existing nodes.
+  /// @param sink Creates the nodes.
+  /// @param observations Holds the latest observation of every location.
+  /// @param history Receives the numeric values.
+  /// @param subscriptions Is told about the subscribers of the value nodes.
+  /// @param log Receives the published values at debug level.
+  /// @param created Called when nodes were created.
+  ObservationPublisher(Publisher& publisher, ValueSink& sink, ObservationStore& observations, HistoryStore& history,
+    Subscriptions& subscriptions, AsyncLog& log, NodesCreated created);
+
+  ObservationPublisher(const ObservationPublisher&) = delete;
+  ObservationPublisher& operator=(const ObservationPublisher&) = delete;
+
+  /// Takes a new observation of an endpoint into the store and its numeric values into the history.
+  /// @param observation The observation, an observed time of 0 is replaced by the fetch time.
+  /// @return false if it is not newer than the stored observation of its location and was dropped.
+  bool accept(Observation& observation);
+
+  /// Publishes the values of an observation. Nodes which do not exist yet are created with the value, existing nodes
+  /// get their value set with the next batch of the publisher.
+  /// @param observation The observation.
+  /// @param timestamp Time the values were observed.
+  /// @param location Index of the location whose subscriptions the value nodes count to, Subscriptions::npos for none.
+  void publish(const Observation& observation, std::chrono::system_clock::time_point timestamp, size_t location);
+
+  /// Publishes observations which were kept while disconnected as one uncoalesced batch, so each value reaches the
+  /// broker with its time. Observations with values whose nodes do not exist yet are published as usual, which creates
+  /// the nodes.
+  /// @param observations The observations, oldest first.
+  void replay(const std::vector<Observation>& observations);
+
+  /// Returns the value of a node for an observed value.
+  /// @param value The observed value.
+  /// @return The node value.
+  static cisco::efm_sdk::Variant variant(const ObservationValue& value);
+
+private:
+  void create_node_locked(const std::string& path);
+
+  Publisher& publisher_;
+  ValueSink& sink_;
+  ObservationStore& observations_;
+  HistoryStore& history_;
+  Subscriptions& subscriptions_;
+  AsyncLog& log_;
+  NodesCreated created_;
+
+  std::mutex mutex_;
+  std::map<std::string, Publisher::Handle> published_; ///< The created nodes, no_handle for the ones without value.
+};
@@ -0,0 +1,163 @@
+#include "parse_pool.h"
+
+#include <algorithm>
+
+
+namespace
+{
+/// The pool and the index of the worker running on this thread, nullptr on other threads.
+thread_local const ParsePool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+}
+
+
+ParsePool::ParsePool(const StageConfig& stage, size_t capacity)
+  : capacity_(std::max<size_t>(capacity, 1))
+{
+  size_t threads = std::max<size_t>(stage.threads_, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  stage_.reset(new Stage("parse", stage, [this]() { run(next_index_++); }));
+}
+
+
+ParsePool::~ParsePool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  work_.notify_all();
+  not_full_.notify_all();
+  stage_.reset();
+}
+
+
+bool ParsePool::submit(std::function<void()> job)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_full_.wait(lock, [this]() { return closed_ || jobs_.size() < capacity_; });
+  if (closed_) {
+    return false;
+  }
+  jobs_.push_back(std::move(job));
+  lock.unlock();
+  work_.notify_one();
+  return true;
+}
+
+
+void ParsePool::parallel_for(size_t count, const std::function<void(size_t)>& body)
+{
+  if (current_pool != this || workers_.size() == 1 || count < 2) {
+    for (size_t i = 0; i < count; ++i) {
+      body(i);
+    }
+    return;
+  }
+
+  auto& own = *workers_[current_index];
+  // Counts the parts still running, the caller sleeps on it once only stolen parts are left.
+  struct Join
+  {
+    std::mutex mutex_;
+    std::condition_variable done_;
+    size_t remaining_;
+  } join;
+  join.remaining_ = count - 1;
+  {
+    // Counted before they are visible, so the count never drops below the number of parts in the deques.
+    std::lock_guard<std::mutex> lock(mutex_);
+    parts_ += count - 1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(own.mutex_);
+    for (size_t i = 1; i < count; ++i) {
+      own.parts_.emplace_back([&body, &join, i]() {
+        body(i);
+        // Notified under the lock, so the caller cannot return and destroy join before this is done with it.
+        std::lock_guard<std::mutex> lock(join.mutex_);
+        if (--join.remaining_ == 0) {
+          join.done_.notify_one();
+        }
+      });
+    }
+  }
+  work_.notify_all();
+
+  body(0);
+  // Works through the parts nobody stole, newest first, then sleeps until the stolen ones are done.
+  std::function<void()> part;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(own.mutex_);
+      if (own.parts_.empty()) {
+        break;
+      }
+      part = std::move(own.parts_.back());
+      own.parts_.pop_back();
+    }
+    --parts_;
+    part();
+    part = nullptr;
+  }
+  std::unique_lock<std::mutex> lock(join.mutex_);
+  join.done_.wait(lock, [&join]() { return join.remaining_ == 0; });
+}
+
+
+void ParsePool::run(size_t index)
+{
+  current_pool = this;
+  current_index = index;
+
+  std::function<void()> task;
+  for (;;) {
+    if (take(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++idle_;
+    work_.wait(lock, [this]() { return closed_ || !jobs_.empty() || parts_ > 0; });
+    --idle_;
+    if (closed_ && jobs_.empty() && parts_ == 0) {
+      return;
+    }
+  }
+}
+
+
+bool ParsePool::take(size_t index, std::function<void()>& task)
+{
+  // Parts of a split job come first, they hold back a job which is already running.
+  for (size_t i = 0; parts_ > 0 && i < workers_.size(); ++i) {
+    auto& worker = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex_);
+    if (!worker.parts_.empty()) {
+      if (i == 0) {
+        task = std::move(worker.parts_.back());
+        worker.parts_.pop_back();
+      } else {
+        task = std::move(worker.parts_.front());
+        worker.parts_.pop_front();
+        ++stolen_;
+      }
+      --parts_;
+      return true;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    task = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  not_full_.notify_one();
+  return true;
+}
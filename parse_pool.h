@@ -0,0 +1,92 @@
+/// @file parse_pool.h
+
+#pragma once
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/// @brief Work-stealing executor of the parse stage.
+/// Parse jobs are submitted to a bounded FIFO queue shared by all workers. A job can split itself with parallel_for():
+/// the parts go to the deque of the worker running the job, which works through them from the back while idle workers
+/// steal from the front. So one large response is parsed by several workers, while many small ones are simply spread
+/// over the workers. Thread safe.
+class ParsePool
+{
+public:
+  /// Starts the workers.
+  /// @param stage Thread count and CPU affinity of the workers.
+  /// @param capacity Maximum number of submitted jobs waiting for a worker, submit() waits while it is reached.
+  ParsePool(const StageConfig& stage, size_t capacity);
+
+  /// Runs the submitted jobs which are left and stops the workers.
+  ~ParsePool();
+
+  ParsePool(const ParsePool&) = delete;
+  ParsePool& operator=(const ParsePool&) = delete;
+
+  /// Queues a job, waits while the queue is full.
+  /// @param job The job.
+  /// @return false if the pool is stopping, the job is not run then.
+  bool submit(std::function<void()> job);
+
+  /// Runs body(0) to body(count - 1) and returns when all of them have finished. Called by a job, the calls are
+  /// shared with idle workers; called by any other thread, or if the pool has a single worker, they run serially.
+  /// @param count Number of parts.
+  /// @param body Runs a part, must not call parallel_for() itself.
+  void parallel_for(size_t count, const std::function<void(size_t)>& body);
+
+  /// Returns the number of workers.
+  /// @return The number of workers.
+  size_t size() const
+  {
+    return workers_.size();
+  }
+
+  /// Returns the number of workers waiting for work, which would pick up the parts of a split job right away.
+  /// @return The number of workers.
+  size_t idle() const
+  {
+    return idle_;
+  }
+
+  /// Returns the number of parts which were run by another worker than the one that split the job.
+  /// @return The number of parts.
+  uint64_t stolen() const
+  {
+    return stolen_;
+  }
+
+private:
+  struct Worker
+  {
+    std::mutex mutex_;
+    std::deque<std::function<void()>> parts_;
+  };
+
+  void run(size_t index);
+  bool take(size_t index, std::function<void()>& task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  const size_t capacity_;
+
+  std::mutex mutex_; ///< Guards jobs_ and closed_, waited on by idle workers.
+  std::condition_variable work_;
+  std::condition_variable not_full_;
+  std::deque<std::function<void()>> jobs_;
+  bool closed_{false};
+  std::atomic<size_t> parts_{0}; ///< Parts in the deques of the workers.
+  std::atomic<size_t> idle_{0};  ///< Workers waiting on work_.
+
+  std::atomic<size_t> next_index_{0};
+  std::atomic<uint64_t> stolen_{0};
+  std::unique_ptr<Stage> stage_;
+};
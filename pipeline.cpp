@@ -0,0 +1,49 @@
+#include "pipeline.h"
+#include "error_code.h"
+
+#include <efm_logging.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+
+namespace
+{
+void set_affinity(std::thread& thread, const std::vector<int>& cpus, const std::string& name)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0) {
+    LOG_EFM_ERROR(responder_error_code::pipeline_error, "could not set the CPU affinity of the " << name << " stage");
+  }
+}
+}
+
+
+Stage::Stage(const std::string& name, const StageConfig& config, std::function<void()> run)
+{
+  size_t threads = config.threads_ > 0 ? config.threads_ : 1;
+  // Linux limits thread names to 15 characters.
+  std::string thread_name = name.substr(0, 15);
+  workers_.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(run);
+    pthread_setname_np(workers_.back().native_handle(), thread_name.c_str());
+    if (!config.cpus_.empty()) {
+      set_affinity(workers_.back(), config.cpus_, name);
+    }
+  }
+}
+
+
+Stage::~Stage()
+{
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
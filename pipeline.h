@@ -0,0 +1,139 @@
+/// @file pipeline.h
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// @brief Bounded multi-producer multi-consumer queue between two pipeline stages.
+/// A full queue blocks push() and fails try_push(), so a slow stage holds back the stage before it instead of letting
+/// the queue grow. After close() the remaining items can still be popped, then pop() fails. Thread safe.
+template <typename T>
+class BoundedQueue
+{
+public:
+  /// Constructs an empty queue.
+  /// @param capacity Maximum number of queued items, at least 1.
+  explicit BoundedQueue(size_t capacity)
+    : capacity_(capacity > 0 ? capacity : 1)
+  {
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  /// Appends an item, waits while the queue is full.
+  /// @param item The item, it is left unchanged if the queue is closed.
+  /// @return false if the queue is closed.
+  bool push(T&& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /// Appends an item if the queue has room. Never blocks, for callers which must not wait on a stage.
+  /// @param item The item, it is left unchanged if it was not queued.
+  /// @return false if the queue is full or closed.
+  bool try_push(T&& item)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_ || items_.size() >= capacity_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /// Removes the oldest item, waits while the queue is empty.
+  /// @param item Receives the item.
+  /// @return false if the queue is closed and empty.
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty()) {
+      return false;
+    }
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  /// Closes the queue and wakes all waiting threads. Further pushes fail.
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  /// Returns the number of queued items.
+  /// @return The number of items.
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+private:
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> items_;
+  bool closed_{false};
+};
+
+
+/// Thread count and CPU affinity of a pipeline stage.
+struct StageConfig
+{
+  size_t threads_;       ///< Number of worker threads, at least 1.
+  std::vector<int> cpus_; ///< CPUs the workers may run on, empty for all.
+};
+
+
+/// @brief The worker threads of a pipeline stage.
+/// Every worker runs the same function, which typically pops from the stage's input queue until it is closed. The
+/// owner closes the queue before the stage is destroyed; the destructor joins the workers.
+class Stage
+{
+public:
+  /// Starts the workers.
+  /// @param name Name of the stage, the workers are named after it for top and debuggers.
+  /// @param config Thread count and CPU affinity.
+  /// @param run Function run by every worker, the stage ends when all of them returned.
+  Stage(const std::string& name, const StageConfig& config, std::function<void()> run);
+
+  /// Joins the workers.
+  ~Stage();
+
+  Stage(const Stage&) = delete;
+  Stage& operator=(const Stage&) = delete;
+
+  /// Returns the number of workers.
+  /// @return The number of workers.
+  size_t size() const
+  {
+    return workers_.size();
+  }
+
+private:
+  std::vector<std::thread> workers_;
+};
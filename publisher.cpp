@@ -0,0 +1,132 @@
+#include "publisher.h"
+#include "error_code.h"
+#include "trace.h"
+
+#include <efm_logging.h>
+
+using namespace cisco::efm_sdk;
+
+
+Publisher::Publisher(ValueSink& sink, Metrics& metrics, const StageConfig& stage, size_t capacity, size_t budget)
+  : sink_(sink), metrics_(metrics), budget_(budget), queue_(capacity)
+  , stage_("publish", StageConfig{1, stage.cpus_}, [this]() { run(); })
+{
+  // Only captures this, so copies of it are stored inline and do not allocate.
+  completed_ = [this](const std::error_code& ec) {
+    if (ec) {
+      ++failed_;
+    }
+    // Callbacks of values forgotten by reset_in_flight() must not wrap the count around.
+    uint64_t in_flight = in_flight_.load(std::memory_order_relaxed);
+    while (in_flight > 0 && !in_flight_.compare_exchange_weak(in_flight, in_flight - 1, std::memory_order_relaxed)) {
+    }
+  };
+}
+
+
+Publisher::~Publisher()
+{
+  queue_.close();
+}
+
+
+Publisher::Handle Publisher::intern(const NodePath& path)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Handle node = static_cast<Handle>(slots_.size());
+  slots_.push_back(Slot{path, Variant{}, std::chrono::system_clock::time_point()});
+  dirty_.resize(slots_.size() / 64 + 1);
+  return node;
+}
+
+
+void Publisher::set_value(Handle node, Variant&& value, std::chrono::system_clock::time_point timestamp)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& slot = slots_[node];
+  slot.value_ = std::move(value);
+  slot.timestamp_ = timestamp;
+  uint64_t bit = uint64_t(1) << (node % 64);
+  if (!(dirty_[node / 64] & bit)) {
+    dirty_[node / 64] |= bit;
+    ++dirty_count_;
+  }
+}
+
+
+void Publisher::flush()
+{
+  Queued queued;
+  uint64_t failures;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failures = failed_ - reported_;
+    reported_ += failures;
+    if (dirty_count_ > 0 && saturated()) {
+      ++deferred_;
+    } else if (dirty_count_ > 0) {
+      metrics_.queue_depth_.record(dirty_count_);
+      queued.batch_.reserve(dirty_count_);
+      for (size_t word = 0; word < dirty_.size(); ++word) {
+        for (uint64_t bits = dirty_[word]; bits != 0; bits &= bits - 1) {
+          auto& slot = slots_[word * 64 + __builtin_ctzll(bits)];
+          queued.batch_.push_back(Update{&slot.path_, std::move(slot.value_), slot.timestamp_});
+        }
+        dirty_[word] = 0;
+      }
+      dirty_count_ = 0;
+    }
+  }
+
+  if (failures > 0) {
+    LOG_EFM_ERROR(responder_error_code::publish_error, failures << " values could not be set");
+  }
+  if (!queued.batch_.empty()) {
+    TraceSpan span("flush");
+    queued.traced_ = Trace::sampled();
+    queue_.push(std::move(queued));
+  }
+}
+
+
+void Publisher::replay(std::vector<Value>&& values)
+{
+  if (values.empty()) return;
+
+  Queued queued;
+  queued.batch_.reserve(values.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& value : values) {
+      queued.batch_.push_back(Update{&slots_[value.node_].path_, std::move(value.value_), value.timestamp_});
+    }
+  }
+  queue_.push(std::move(queued));
+}
+
+
+void Publisher::run()
+{
+  Queued queued;
+  while (queue_.pop(queued)) {
+    send(queued.batch_, queued.traced_);
+    queued.batch_.clear();
+  }
+}
+
+
+void Publisher::send(Batch& batch, bool traced)
+{
+  // The batch belongs to the cycle which flushed it.
+  TraceCycle cycle(traced);
+  TraceSpan span("send");
+  auto start = std::chrono::steady_clock::now();
+  in_flight_ += batch.size();
+  for (auto& update : batch) {
+    sink_.set_value(*update.path_, std::move(update.value_), update.timestamp_,
+      std::function<void(const std::error_code&)>(completed_));
+  }
+  sent_ += batch.size();
+  metrics_.publish_.record(
+    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
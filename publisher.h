@@ -0,0 +1,217 @@
+/// @file publisher.h
+
+#pragma once
+
+#include "metrics.h"
+#include "pipeline.h"
+
+#include <efm_link.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/// @brief Receives the values sent by a Publisher and the nodes created for new values. The link passes them to its
+/// responder, the replay tool counts them.
+class ValueSink
+{
+public:
+  virtual ~ValueSink() = default;
+
+  /// Adds nodes.
+  /// @param builder The nodes.
+  /// @param created Called with the created paths or the error once the nodes were added.
+  virtual void add_node(cisco::efm_sdk::NodeBuilder&& builder,
+    std::function<void(const std::vector<cisco::efm_sdk::NodePath>&, const std::error_code&)>&& created) = 0;
+
+  /// Sets the value of a node, called by the worker of the publish stage.
+  /// @param path Path of the node.
+  /// @param value The new value.
+  /// @param timestamp Time the value was updated.
+  /// @param completed Has to be called once the value is set or failed, it is cheap to copy.
+  virtual void set_value(const cisco::efm_sdk::NodePath& path, cisco::efm_sdk::Variant&& value,
+    std::chrono::system_clock::time_point timestamp, std::function<void(const std::error_code&)>&& completed) = 0;
+};
+
+
+/// @brief Sets the values on the responder of a link.
+class ResponderSink : public ValueSink
+{
+public:
+  /// Constructs a sink.
+  /// @param link The link whose responder the values are set on.
+  explicit ResponderSink(cisco::efm_sdk::Link& link)
+    : responder_(link.responder())
+  {
+  }
+
+  void add_node(cisco::efm_sdk::NodeBuilder&& builder,
+    std::function<void(const std::vector<cisco::efm_sdk::NodePath>&, const std::error_code&)>&& created) override
+  {
+    responder_.add_node(std::move(builder), std::move(created));
+  }
+
+  void set_value(const cisco::efm_sdk::NodePath& path, cisco::efm_sdk::Variant&& value,
+    std::chrono::system_clock::time_point timestamp, std::function<void(const std::error_code&)>&& completed) override
+  {
+    responder_.set_value(path, std::move(value), timestamp, std::move(completed));
+  }
+
+private:
+  cisco::efm_sdk::Responder& responder_;
+};
+
+
+/// @brief Collects the value updates of a poll cycle and sends them to the responder in one batch.
+/// Nodes are interned once into dense handles. The latest value of every node is kept in a slot indexed by its handle
+/// and marked in a dirty bitmap, so updates of a node between two flushes collapse into one, and the pending values
+/// never outnumber the nodes, whatever the update rate. flush() collects the dirty slots into a batch for the publish
+/// stage, whose one worker sets the values in the order of the batches, each with a copy of one shared completion
+/// callback that only counts failures. So the responder calls run neither on the link threads nor on the threads producing the values.
+/// The values set but not yet confirmed by the responder are limited by a budget. While it is used up, flush() keeps
+/// the dirty slots, so the updates of the following cycles are coalesced into them instead of piling up in the
+/// responder. Thread safe.
+class Publisher
+{
+public:
+  /// Constructs a publisher.
+  /// @param sink Receives the values, e.g. a ResponderSink.
+  /// @param metrics Receives the queue depth and the time to send a batch.
+  /// @param stage CPU affinity of the publish stage, its one thread sends the batches in the order they were queued.
+  /// @param capacity Maximum number of batches waiting for the publish stage, flush() waits while it is reached.
+  /// @param budget Maximum number of values waiting for their confirmation by the responder, 0 for no limit.
+  Publisher(ValueSink& sink, Metrics& metrics, const StageConfig& stage, size_t capacity, size_t budget);
+
+  /// Sends the queued batches and stops the publish stage.
+  ~Publisher();
+
+  Publisher(const Publisher&) = delete;
+  Publisher& operator=(const Publisher&) = delete;
+
+  /// Handle of an interned node.
+  using Handle = uint32_t;
+
+  /// Interns a node, values are set through the returned handle. Every call returns a new handle, callers intern a
+  /// node once, e.g. when they create it.
+  /// @param path Path of the node.
+  /// @return The handle.
+  Handle intern(const cisco::efm_sdk::NodePath& path);
+
+  /// Sets the value of a node with the next batch, it replaces a value set since the last batch. The node has to
+  /// exist.
+  /// @param node Handle of the node.
+  /// @param value The new value.
+  /// @param timestamp Time the value was updated.
+  void set_value(Handle node, cisco::efm_sdk::Variant&& value, std::chrono::system_clock::time_point timestamp);
+
+  /// A value with the time it was observed.
+  struct Value
+  {
+    Handle node_;
+    cisco::efm_sdk::Variant value_;
+    std::chrono::system_clock::time_point timestamp_;
+  };
+
+  /// Queues values for the publish stage as one batch of their own, without coalescing them, so every value reaches
+  /// the broker with its timestamp, e.g. the values observed while disconnected. The batch counts to the budget like
+  /// any other, callers limit how many values they replay at once. The nodes have to exist.
+  /// @param values The values, oldest first.
+  void replay(std::vector<Value>&& values);
+
+  /// Sends the current batch, if there is one, and starts a new one. While the budget is used up the batch is kept and
+  /// coalesces the following updates. Reports the values which failed since the last flush.
+  void flush();
+
+  /// Returns whether the values waiting for their confirmation have used up the budget. Producers should hold back
+  /// then, their values would only be coalesced.
+  /// @return true if the budget is used up.
+  bool saturated() const
+  {
+    return budget_ > 0 && in_flight_ >= budget_;
+  }
+
+  /// Forgets the values waiting for their confirmation, e.g. after the connection to the broker was reestablished
+  /// and their callbacks may never come.
+  void reset_in_flight()
+  {
+    in_flight_ = 0;
+  }
+
+  /// Returns the number of values waiting for their confirmation by the responder.
+  /// @return The number of values.
+  uint64_t in_flight() const
+  {
+    return in_flight_;
+  }
+
+  /// Returns the number of flushes which kept their batch because the budget was used up.
+  /// @return The number of flushes.
+  uint64_t deferred() const
+  {
+    return deferred_;
+  }
+
+  /// Returns the number of values sent to the responder.
+  /// @return The number of values.
+  uint64_t sent() const
+  {
+    return sent_;
+  }
+
+  /// Returns the number of values the responder failed to set.
+  /// @return The number of values.
+  uint64_t failed() const
+  {
+    return failed_;
+  }
+
+private:
+  /// The latest value of a node which has not been sent yet.
+  struct Slot
+  {
+    cisco::efm_sdk::NodePath path_;
+    cisco::efm_sdk::Variant value_;
+    std::chrono::system_clock::time_point timestamp_;
+  };
+
+  struct Update
+  {
+    const cisco::efm_sdk::NodePath* path_; ///< Path of the slot, it never changes once interned.
+    cisco::efm_sdk::Variant value_;
+    std::chrono::system_clock::time_point timestamp_;
+  };
+  using Batch = std::vector<Update>;
+  struct Queued
+  {
+    Batch batch_;
+    bool traced_{false}; ///< Whether the batch belongs to a traced cycle.
+  };
+
+  void run();
+  void send(Batch& batch, bool traced);
+
+  ValueSink& sink_;
+  Metrics& metrics_;
+  std::function<void(const std::error_code&)> completed_;
+
+  std::mutex mutex_;
+  std::deque<Slot> slots_;      ///< Indexed by handle, a deque so the paths do not move when slots are added.
+  std::vector<uint64_t> dirty_; ///< Bit per slot, set if it has a value to send.
+  size_t dirty_count_{0};
+
+  const size_t budget_;
+  std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> failed_{0};
+  std::atomic<uint64_t> in_flight_{0};
+  std::atomic<uint64_t> deferred_{0};
+  uint64_t reported_{0}; ///< failed_ at the last report, guarded by mutex_.
+
+  BoundedQueue<Queued> queue_;
+  Stage stage_; ///< Last member, the worker only starts when everything else is constructed.
+};
@@ -0,0 +1,220 @@
+#include "recording.h"
+#include "checksum.h"
+
+#include <cstring>
+
+
+namespace
+{
+const char recording_magic[8] = {'O', 'W', 'M', 'R', 'E', 'C', '\0', '\0'};
+const uint32_t recording_version = 1;
+
+// Layout, all integers in host byte order:
+//   magic[8] version:u32
+//   n * { size:u32 crc32:u32 (of the payload)
+//         payload: endpoint:str path:str query:str latitude:f64 longitude:f64 fetched:i64 fetch_time:i64 body }
+// where str is a u16 length followed by the bytes and the body takes the rest of the payload.
+
+template <typename T>
+void put(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void put(std::string& out, const std::string& value)
+{
+  put(out, static_cast<uint16_t>(value.size()));
+  out.append(value, 0, static_cast<uint16_t>(value.size()));
+}
+
+class Cursor
+{
+public:
+  Cursor(const char* begin, const char* end)
+    : position_(begin), end_(end)
+  {
+  }
+
+  template <typename T>
+  bool get(T& value)
+  {
+    if (static_cast<size_t>(end_ - position_) < sizeof(value)) {
+      return false;
+    }
+    std::memcpy(&value, position_, sizeof(value));
+    position_ += sizeof(value);
+    return true;
+  }
+
+  bool get(std::string& value)
+  {
+    uint16_t size;
+    if (!get(size) || static_cast<size_t>(end_ - position_) < size) {
+      return false;
+    }
+    value.assign(position_, size);
+    position_ += size;
+    return true;
+  }
+
+  void rest(std::string& value)
+  {
+    value.assign(position_, end_);
+    position_ = end_;
+  }
+
+private:
+  const char* position_;
+  const char* end_;
+};
+
+bool read_header(FILE* file)
+{
+  char magic[sizeof(recording_magic)];
+  uint32_t version;
+  return std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+         std::memcmp(magic, recording_magic, sizeof(magic)) == 0 && std::fread(&version, sizeof(version), 1, file) == 1 &&
+         version == recording_version;
+}
+}
+
+
+Recorder::~Recorder()
+{
+  if (file_) {
+    std::fclose(file_);
+  }
+}
+
+
+bool Recorder::open(const std::string& file_name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  FILE* file = std::fopen(file_name.c_str(), "a+b");
+  if (!file) {
+    return false;
+  }
+
+  std::fseek(file, 0, SEEK_END);
+  bool valid;
+  if (std::ftell(file) == 0) {
+    valid = std::fwrite(recording_magic, 1, sizeof(recording_magic), file) == sizeof(recording_magic) &&
+            std::fwrite(&recording_version, sizeof(recording_version), 1, file) == 1;
+  } else {
+    std::rewind(file);
+    valid = read_header(file);
+  }
+  // Writing after reading needs a seek in between.
+  if (!valid || std::fseek(file, 0, SEEK_END) != 0) {
+    std::fclose(file);
+    return false;
+  }
+
+  if (file_) {
+    std::fclose(file_);
+  }
+  file_ = file;
+  return true;
+}
+
+
+bool Recorder::write(const Recording& recording)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_) {
+    return false;
+  }
+
+  buffer_.clear();
+  put(buffer_, uint32_t(0));
+  put(buffer_, uint32_t(0));
+  put(buffer_, recording.endpoint_);
+  put(buffer_, recording.location_.path_);
+  put(buffer_, recording.location_.query_);
+  put(buffer_, recording.location_.latitude_);
+  put(buffer_, recording.location_.longitude_);
+  put(buffer_, recording.fetched_);
+  put(buffer_, recording.fetch_time_);
+  buffer_.append(recording.body_);
+
+  const size_t header = 2 * sizeof(uint32_t);
+  uint32_t size = static_cast<uint32_t>(buffer_.size() - header);
+  uint32_t crc = crc32(buffer_.data() + header, size);
+  std::memcpy(&buffer_[0], &size, sizeof(size));
+  std::memcpy(&buffer_[sizeof(size)], &crc, sizeof(crc));
+
+  // Appended with one write, so a record is never interleaved with another process appending to the file.
+  return std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size() && std::fflush(file_) == 0;
+}
+
+
+RecordingReader::~RecordingReader()
+{
+  if (file_) {
+    std::fclose(file_);
+  }
+}
+
+
+bool RecordingReader::open(const std::string& file_name)
+{
+  FILE* file = std::fopen(file_name.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  long end = -1;
+  if (std::fseek(file, 0, SEEK_END) == 0) {
+    end = std::ftell(file);
+    std::rewind(file);
+  }
+  if (end < 0 || !read_header(file)) {
+    std::fclose(file);
+    return false;
+  }
+  if (file_) {
+    std::fclose(file_);
+  }
+  file_ = file;
+  end_ = end;
+  damaged_ = false;
+  return true;
+}
+
+
+bool RecordingReader::next(Recording& recording)
+{
+  if (!file_) {
+    return false;
+  }
+
+  uint32_t header[2];
+  size_t read = std::fread(header, 1, sizeof(header), file_);
+  if (read != sizeof(header)) {
+    damaged_ = read != 0;
+    return false;
+  }
+
+  // A damaged size must not allocate more than the file could hold.
+  long position = std::ftell(file_);
+  if (position < 0 || header[0] > static_cast<unsigned long>(end_ - position)) {
+    damaged_ = true;
+    return false;
+  }
+  buffer_.resize(header[0]);
+  if (std::fread(&buffer_[0], 1, buffer_.size(), file_) != buffer_.size() ||
+      crc32(buffer_.data(), buffer_.size()) != header[1]) {
+    damaged_ = true;
+    return false;
+  }
+
+  Cursor cursor(buffer_.data(), buffer_.data() + buffer_.size());
+  if (!cursor.get(recording.endpoint_) || !cursor.get(recording.location_.path_) ||
+      !cursor.get(recording.location_.query_) || !cursor.get(recording.location_.latitude_) ||
+      !cursor.get(recording.location_.longitude_) || !cursor.get(recording.fetched_) ||
+      !cursor.get(recording.fetch_time_)) {
+    damaged_ = true;
+    return false;
+  }
+  cursor.rest(recording.body_);
+  return true;
+}
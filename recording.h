@@ -0,0 +1,92 @@
+/// @file recording.h
+
+#pragma once
+
+#include "location.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+
+/// A response as it was received by an endpoint.
+struct Recording
+{
+  std::string endpoint_; ///< Name of the endpoint.
+  Location location_{};  ///< The polled location.
+  int64_t fetched_{0};   ///< Time the response was received in ms since the epoch.
+  int64_t fetch_time_{0}; ///< Duration of the request in µs.
+  std::string body_;     ///< The response body.
+};
+
+
+/// @brief Appends the responses received by the endpoints to a binary recording, which can be replayed by the replay
+/// tool. Every record carries its own length and checksum, so a recording cut off by a crash can be read up to the
+/// last complete record. Thread safe.
+class Recorder
+{
+public:
+  Recorder() = default;
+  ~Recorder();
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  /// Opens a recording, the responses are appended to an existing one.
+  /// @param file_name The recording file.
+  /// @return false if the file could not be opened or is not a recording.
+  bool open(const std::string& file_name);
+
+  /// Returns whether a recording is open.
+  /// @return true if responses are recorded.
+  bool is_open() const
+  {
+    return file_ != nullptr;
+  }
+
+  /// Appends a response.
+  /// @param recording The response.
+  /// @return false if it could not be written.
+  bool write(const Recording& recording);
+
+private:
+  std::mutex mutex_;
+  FILE* file_{nullptr};
+  std::string buffer_;
+};
+
+
+/// @brief Reads a recording written by the Recorder.
+class RecordingReader
+{
+public:
+  RecordingReader() = default;
+  ~RecordingReader();
+
+  RecordingReader(const RecordingReader&) = delete;
+  RecordingReader& operator=(const RecordingReader&) = delete;
+
+  /// Opens a recording.
+  /// @param file_name The recording file.
+  /// @return false if the file is missing or not a recording.
+  bool open(const std::string& file_name);
+
+  /// Reads the next response.
+  /// @param recording Receives the response.
+  /// @return false at the end of the recording or at the first incomplete or damaged record.
+  bool next(Recording& recording);
+
+  /// Returns whether reading stopped at an incomplete or damaged record instead of the end of the file.
+  /// @return true if the rest of the recording was skipped.
+  bool damaged() const
+  {
+    return damaged_;
+  }
+
+private:
+  FILE* file_{nullptr};
+  long end_{0}; ///< Size of the file when it was opened.
+  std::string buffer_;
+  bool damaged_{false};
+};
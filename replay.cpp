@@ -0,0 +1,262 @@
+#include "async_log.h"
+#include "endpoint.h"
+#include "forecast.h"
+#include "histogram.h"
+#include "history.h"
+#include "metrics.h"
+#include "observation.h"
+#include "observation_publisher.h"
+#include "parse_pool.h"
+#include "publisher.h"
+#include "recording.h"
+#include "subscriptions.h"
+#include "weather_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cisco::efm_sdk;
+using namespace std;
+
+
+// Stands in for the responder of the link: confirms every value at once and counts the values and the added nodes.
+class CountingSink : public ValueSink
+{
+public:
+  void add_node(NodeBuilder&&, function<void(const vector<NodePath>&, const std::error_code&)>&&) override
+  {
+    ++nodes_;
+  }
+
+  void set_value(const NodePath&, Variant&&, chrono::system_clock::time_point,
+    function<void(const std::error_code&)>&& completed) override
+  {
+    ++set_;
+    completed(std::error_code());
+  }
+
+  atomic<size_t> nodes_{0};
+  atomic<size_t> set_{0};
+};
+
+
+// The stores and the publish path of the link for one pass over the recording. The endpoints process the responses
+// on the parse pool, the observations go through the ObservationPublisher of the link into the history and the
+// publisher, the forecasts into the forecast store. There is no spill, a replay is always connected.
+class ReplayLink : public EndpointSink
+{
+public:
+  ReplayLink(const WeatherConfig& config, const vector<Location>& locations, ValueSink& sink, Metrics& metrics)
+    : history_(chrono::duration_cast<chrono::milliseconds>(config.history_retention).count())
+    , subscriptions_(locations)
+    , publisher_(sink, metrics, config.publish_stage, config.stage_queue_capacity, config.publish_budget)
+    , observation_publisher_(publisher_, sink, observations_, history_, subscriptions_, log_, nullptr)
+  {
+  }
+
+  void received(const Location&, const string&, int64_t) override
+  {
+  }
+
+  bool publish(const Observation& result) override
+  {
+    Observation observation = result;
+    if (!observation_publisher_.accept(observation)) {
+      ++stale_;
+      return false;
+    }
+    observation_publisher_.publish(observation,
+      chrono::system_clock::time_point(chrono::milliseconds(observation.observed_)),
+      subscriptions_.find(observation.path_));
+    published_ += observation.values_.size();
+    return true;
+  }
+
+  void publish(const Location& location, const Forecast& forecast) override
+  {
+    forecasts_.update(location.path_, forecast);
+    forecast_steps_ += forecast.count_;
+  }
+
+  // Sends the values of a response as one batch, as the end of a poll cycle does.
+  void flush()
+  {
+    publisher_.flush();
+  }
+
+  atomic<size_t> published_{0};
+  atomic<size_t> stale_{0};
+  atomic<size_t> forecast_steps_{0};
+
+private:
+  AsyncLog log_;
+  ObservationStore observations_;
+  HistoryStore history_;
+  ForecastStore forecasts_;
+  Subscriptions subscriptions_;
+  Publisher publisher_;
+  ObservationPublisher observation_publisher_;
+};
+
+
+static unique_ptr<Endpoint> make_endpoint(const string& name, ParsePool& pool, const WeatherConfig& config)
+{
+  const chrono::seconds interval(0);
+  if (name == "weather") return unique_ptr<Endpoint>(new WeatherEndpoint(interval));
+  if (name == "forecast") {
+    auto* forecast = new ForecastEndpoint(interval);
+    forecast->set_parallel(bind(&ParsePool::parallel_for, &pool, placeholders::_1, placeholders::_2),
+      bind(&ParsePool::idle, &pool), config.parse_split_kb * 1024);
+    return unique_ptr<Endpoint>(forecast);
+  }
+  if (name == "air_pollution") return unique_ptr<Endpoint>(new AirPollutionEndpoint(interval));
+  return nullptr;
+}
+
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <recording> [--original] [--repeat <n>] [--config <file>]\n", argv[0]);
+    fprintf(stderr, "  --original     replay with the original timing instead of as fast as possible\n");
+    fprintf(stderr, "  --repeat n     replay the recording n times\n");
+    fprintf(stderr, "  --config file  take the stage and history settings from a link configuration\n");
+    return EXIT_FAILURE;
+  }
+  bool original = false;
+  int repeat = 1;
+  WeatherConfig config;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--original") == 0) {
+      original = true;
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      if (!config.load(argv[++i])) {
+        fprintf(stderr, "%s is not a valid configuration\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  // Load the recording first, so reading the file is not part of the measurement.
+  RecordingReader reader;
+  if (!reader.open(argv[1])) {
+    fprintf(stderr, "%s is not a recording\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  vector<Recording> recordings;
+  vector<Location> locations;
+  set<string> location_paths;
+  Recording recording;
+  size_t bytes = 0;
+  while (reader.next(recording)) {
+    bytes += recording.body_.size();
+    if (location_paths.insert(recording.location_.path_).second) {
+      locations.push_back(recording.location_);
+    }
+    recordings.push_back(recording);
+  }
+  if (reader.damaged()) {
+    fprintf(stderr, "recording is damaged after %zu responses, replaying those\n", recordings.size());
+  }
+  if (recordings.empty()) {
+    fprintf(stderr, "recording is empty\n");
+    return EXIT_FAILURE;
+  }
+
+  ParsePool pool(config.parse_stage, config.stage_queue_capacity);
+  map<string, unique_ptr<Endpoint>> endpoints;
+  CountingSink values;
+  Metrics metrics;
+  Histogram process_time;
+  atomic<size_t> failed{0};
+  size_t unknown = 0;
+  size_t published = 0;
+  size_t stale = 0;
+  size_t forecast_steps = 0;
+
+  mutex pending_mutex;
+  condition_variable finished;
+  size_t pending = 0;
+
+  auto start = chrono::steady_clock::now();
+  for (int pass = 0; pass < repeat; ++pass) {
+    // Every pass replays the same observation times, it starts with empty stores so they are published again.
+    ReplayLink link(config, locations, values, metrics);
+    auto pass_start = chrono::steady_clock::now();
+    for (const auto& response : recordings) {
+      if (original) {
+        this_thread::sleep_until(pass_start + chrono::milliseconds(response.fetched_ - recordings.front().fetched_));
+      }
+
+      auto& endpoint = endpoints[response.endpoint_];
+      if (!endpoint) {
+        endpoint = make_endpoint(response.endpoint_, pool, config);
+      }
+      if (!endpoint) {
+        ++unknown;
+        continue;
+      }
+
+      {
+        lock_guard<mutex> lock(pending_mutex);
+        ++pending;
+      }
+      auto* target = &link;
+      auto* processor = endpoint.get();
+      auto* job = &response;
+      // Waits while the parse stage is behind, as the fetch stage of the link does.
+      pool.submit([&, target, processor, job]() {
+        auto process_start = chrono::steady_clock::now();
+        if (!processor->process(job->location_, job->body_, job->fetched_, *target)) {
+          ++failed;
+        }
+        target->flush();
+        process_time.record(
+          chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - process_start).count());
+        lock_guard<mutex> lock(pending_mutex);
+        if (--pending == 0) {
+          finished.notify_all();
+        }
+      });
+    }
+    {
+      unique_lock<mutex> lock(pending_mutex);
+      finished.wait(lock, [&pending]() { return pending == 0; });
+    }
+    published += link.published_;
+    stale += link.stale_;
+    forecast_steps += link.forecast_steps_;
+    // The destructor of the link waits until the publish stage has sent the queued batches.
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  auto summary = process_time.collect();
+  size_t responses = recordings.size() * repeat;
+  printf("responses:          %zu (%zu bytes) x %d\n", recordings.size(), bytes, repeat);
+  printf("failed / unknown:   %zu / %zu\n", failed.load(), unknown);
+  printf("values published:   %zu, %zu sent in %zu batches, %zu stale observations skipped\n", published,
+    values.set_.load(), static_cast<size_t>(metrics.publish_.total()), stale);
+  printf("nodes added:        %zu\n", values.nodes_.load());
+  printf("forecast steps:     %zu, %zu parts parsed by other workers\n", forecast_steps,
+    static_cast<size_t>(pool.stolen()));
+  printf("elapsed:            %.3f s\n", seconds);
+  printf("throughput:         %.0f responses/s, %.1f MB/s\n", responses / seconds,
+    bytes * static_cast<double>(repeat) / seconds / 1e6);
+  printf("process time:       p50 %.1f µs, p99 %.1f µs, max %.1f µs (parse and publish)\n", summary.p50_ / 1e3,
+    summary.p99_ / 1e3, summary.max_ / 1e3);
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
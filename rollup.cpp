@@ -0,0 +1,77 @@
+#include "rollup.h"
+#include "history.h"
+
+#include <algorithm>
+#include <vector>
+
+
+const RollupLevel rollup_levels[2] = {
+  {"10m", 10 * 60 * 1000},
+  {"1h", 60 * 60 * 1000},
+};
+
+
+RollupSeries::RollupSeries(const RollupLevel& level, HistorySeries* const (&series)[FieldCount])
+  : width_(level.width_)
+{
+  std::copy(series, series + FieldCount, series_);
+}
+
+
+void RollupSeries::add(int64_t timestamp, double value, const HistorySeries& raw)
+{
+  if (!seeded_) {
+    seeded_ = true;
+    // The raw samples after the last stored bucket, e.g. of the bucket which was unfinished when the link stopped,
+    // are rolled up first, so the new sample does not leave a hole before its bucket.
+    int64_t stored = series_[Mean]->last_timestamp();
+    std::vector<Sample> samples;
+    raw.read(stored == 0 ? 0 : stored + width_, timestamp - 1, samples);
+    for (const auto& sample : samples) {
+      step(sample.timestamp_, sample.value_);
+    }
+  }
+  step(timestamp, value);
+}
+
+
+std::string RollupSeries::key(const std::string& path, const RollupLevel& level, Field field)
+{
+  static const char* const names[FieldCount] = {"min", "max", "mean", "last"};
+  return path + "@" + level.name_ + "." + names[field];
+}
+
+
+void RollupSeries::step(int64_t timestamp, double value)
+{
+  int64_t start = timestamp - timestamp % width_;
+  if (count_ > 0 && start != start_) {
+    flush();
+  }
+  start_ = start;
+  accumulate(value);
+}
+
+
+void RollupSeries::accumulate(double value)
+{
+  if (count_ == 0) {
+    min_ = max_ = sum_ = value;
+  } else {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += value;
+  }
+  last_ = value;
+  ++count_;
+}
+
+
+void RollupSeries::flush()
+{
+  series_[Min]->append(start_, min_);
+  series_[Max]->append(start_, max_);
+  series_[Mean]->append(start_, sum_ / count_);
+  series_[Last]->append(start_, last_);
+  count_ = 0;
+}
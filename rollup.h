@@ -0,0 +1,87 @@
+/// @file rollup.h
+
+#pragma once
+
+#include "gorilla.h"
+
+#include <cstdint>
+#include <string>
+
+
+class HistorySeries;
+
+
+/// Min, max, mean and last value of the samples in a time bucket.
+struct HistoryRow
+{
+  int64_t timestamp_; ///< Start of the bucket or the timestamp of a raw sample in ms since the epoch.
+  double value_;      ///< Mean value of the bucket or the raw value.
+  double min_;        ///< Minimum value of the bucket.
+  double max_;        ///< Maximum value of the bucket.
+  double last_;       ///< Last value of the bucket.
+};
+
+
+/// A resolution history is rolled up to.
+struct RollupLevel
+{
+  const char* name_; ///< Name of the level, used as suffix of the series keys and in the history action.
+  int64_t width_;    ///< Bucket width in ms.
+};
+
+/// The rollup levels, finest first.
+extern const RollupLevel rollup_levels[2];
+
+
+/// @brief Incrementally maintained rollup of one metric at one resolution.
+/// Samples are accumulated into the current bucket. When a sample of a later bucket arrives, the completed bucket is
+/// appended to four HistorySeries, one for each aggregate, so rollups are compressed, persisted and read exactly like
+/// the raw history. Must only be used by the writer of the raw series.
+class RollupSeries
+{
+public:
+  /// The aggregates stored per bucket, also the index into the series.
+  enum Field
+  {
+    Min,
+    Max,
+    Mean,
+    Last,
+    FieldCount
+  };
+
+  /// Constructs a rollup.
+  /// @param level The resolution of the rollup.
+  /// @param series The series to store the aggregates in, indexed by Field.
+  RollupSeries(const RollupLevel& level, HistorySeries* const (&series)[FieldCount]);
+
+  /// Adds a sample which has just been appended to the raw series. After a restart, the first call rolls up the raw
+  /// samples newer than the last stored bucket before it, including the bucket which was unfinished.
+  /// @param timestamp Observation time in ms since the epoch.
+  /// @param value The observed value.
+  /// @param raw The raw series of the metric.
+  void add(int64_t timestamp, double value, const HistorySeries& raw);
+
+  /// Returns the key of the series storing one aggregate of a level for a metric.
+  /// @param path The node path of the metric.
+  /// @param level The rollup level.
+  /// @param field The aggregate.
+  /// @return The series key.
+  static std::string key(const std::string& path, const RollupLevel& level, Field field);
+
+private:
+  void step(int64_t timestamp, double value);
+  void accumulate(double value);
+  void flush();
+
+  int64_t width_;
+  HistorySeries* series_[FieldCount];
+  bool seeded_{false};
+
+  int64_t start_{0};
+  uint32_t count_{0};
+  double min_{0};
+  double max_{0};
+  double sum_{0};
+  double last_{0};
+};
@@ -0,0 +1,83 @@
+#include "scheduler.h"
+
+using namespace cisco::efm_sdk;
+
+
+Scheduler::Scheduler(Link& link)
+  : link_(link)
+{
+}
+
+
+Scheduler::Task Scheduler::add(std::chrono::milliseconds interval, std::function<void(Task)> run)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.push_back(Entry{interval, std::move(run), State::Waiting, 0});
+  Task task = entries_.size() - 1;
+  if (!paused_) {
+    arm_locked(task, std::chrono::seconds(1));
+  }
+  return task;
+}
+
+
+void Scheduler::done(Task task)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = entries_[task];
+  if (entry.state_ != State::Running) return;
+  if (paused_) {
+    entry.state_ = State::Waiting;
+  } else {
+    arm_locked(task, entry.interval_);
+  }
+}
+
+
+void Scheduler::pause()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  paused_ = true;
+  // Their timers are stale from now on, resume() arms new ones.
+  for (auto& entry : entries_) {
+    if (entry.state_ == State::Armed) {
+      entry.state_ = State::Waiting;
+    }
+  }
+}
+
+
+void Scheduler::resume()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  paused_ = false;
+  auto delay = std::chrono::seconds(1);
+  for (Task task = 0; task < entries_.size(); ++task) {
+    if (entries_[task].state_ == State::Waiting) {
+      arm_locked(task, delay++);
+    }
+  }
+}
+
+
+void Scheduler::arm_locked(Task task, std::chrono::milliseconds delay)
+{
+  auto& entry = entries_[task];
+  entry.state_ = State::Armed;
+  uint64_t generation = ++entry.generation_;
+  link_.schedule_timed_task(delay, [this, task, generation]() { fired(task, generation); });
+}
+
+
+void Scheduler::fired(Task task, uint64_t generation)
+{
+  std::function<void(Task)> run;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = entries_[task];
+    if (entry.state_ != State::Armed || entry.generation_ != generation) return;
+    entry.state_ = State::Running;
+    run = entry.run_;
+  }
+  run(task);
+}
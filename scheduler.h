@@ -0,0 +1,73 @@
+/// @file scheduler.h
+
+#pragma once
+
+#include <efm_link.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+
+/// @brief Runs recurring tasks on the link's timers, paused and resumed by the connection events.
+/// A task is started by its timer and may finish asynchronously, e.g. a poll cycle which ends when its last response
+/// has been processed; done() then arms the timer of its next run. Every task has at most one timer or run at a time:
+/// a pause drops the armed timers and a resume arms new ones, so a timer armed before a pause which fires after a
+/// resume carries an old generation and is ignored. Connections which drop and come back quickly never start a second
+/// chain of the same task. Thread safe.
+class Scheduler
+{
+public:
+  /// Constructs a paused scheduler.
+  /// @param link The link whose timers run the tasks.
+  explicit Scheduler(cisco::efm_sdk::Link& link);
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  /// Identifies a task.
+  using Task = size_t;
+
+  /// Adds a task, it is first run when the scheduler is resumed.
+  /// @param interval Delay between the end of a run and the start of the next.
+  /// @param run Starts a run of the task passed to it, which has to end with a call of done().
+  /// @return The task.
+  Task add(std::chrono::milliseconds interval, std::function<void(Task)> run);
+
+  /// Ends a run of a task and arms its timer for the next one. While paused the task waits for resume() instead.
+  /// @param task The task.
+  void done(Task task);
+
+  /// Stops starting runs. Runs in progress finish, the armed timers are dropped and their tasks wait for resume().
+  void pause();
+
+  /// Starts the runs again. The tasks which are not running are armed, one second apart so they do not all start at
+  /// once.
+  void resume();
+
+private:
+  enum class State
+  {
+    Waiting, ///< Waits for resume().
+    Armed,   ///< Its timer is armed, never while paused.
+    Running  ///< Waits for done().
+  };
+
+  struct Entry
+  {
+    std::chrono::milliseconds interval_;
+    std::function<void(Task)> run_;
+    State state_;
+    uint64_t generation_; ///< Incremented whenever the timer is armed, a timer of another generation is stale.
+  };
+
+  void arm_locked(Task task, std::chrono::milliseconds delay);
+  void fired(Task task, uint64_t generation);
+
+  cisco::efm_sdk::Link& link_;
+  std::mutex mutex_;
+  std::vector<Entry> entries_;
+  bool paused_{true};
+};
@@ -0,0 +1,216 @@
+#include "snapshot.h"
+#include "checksum.h"
+#include "error_code.h"
+
+#include <efm_logging.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <unistd.h>
+
+
+namespace
+{
+const char snapshot_magic[8] = {'O', 'W', 'M', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t snapshot_version = 1;
+
+// Layout, all integers in host byte order:
+//   magic[8] version:u32 count:u32 count * observation crc32:u32 of everything before
+// where an observation is
+//   path:str observed:i64 fetched:i64 value_count:u16 value_count * { name:str type:u8 (i64 | f64 | str) }
+// and str is a u16 length followed by the bytes.
+
+template <typename T>
+void put(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void put(std::string& out, const std::string& value)
+{
+  put(out, static_cast<uint16_t>(value.size()));
+  out.append(value, 0, static_cast<uint16_t>(value.size()));
+}
+
+class Cursor
+{
+public:
+  Cursor(const char* begin, const char* end)
+    : position_(begin), end_(end)
+  {
+  }
+
+  template <typename T>
+  bool get(T& value)
+  {
+    if (static_cast<size_t>(end_ - position_) < sizeof(value)) {
+      return false;
+    }
+    std::memcpy(&value, position_, sizeof(value));
+    position_ += sizeof(value);
+    return true;
+  }
+
+  bool get(std::string& value)
+  {
+    uint16_t size;
+    if (!get(size) || static_cast<size_t>(end_ - position_) < size) {
+      return false;
+    }
+    value.assign(position_, size);
+    position_ += size;
+    return true;
+  }
+
+  bool done() const
+  {
+    return position_ == end_;
+  }
+
+private:
+  const char* position_;
+  const char* end_;
+};
+
+bool get_observation(Cursor& cursor, Observation& observation)
+{
+  uint16_t value_count;
+  if (!cursor.get(observation.path_) || !cursor.get(observation.observed_) || !cursor.get(observation.fetched_) ||
+      !cursor.get(value_count)) {
+    return false;
+  }
+  observation.values_.resize(value_count);
+  for (auto& value : observation.values_) {
+    uint8_t type;
+    if (!cursor.get(value.name_) || !cursor.get(type)) {
+      return false;
+    }
+    value.type_ = static_cast<ObservationValue::Type>(type);
+    bool valid = false;
+    switch (value.type_) {
+      case ObservationValue::Int:
+        valid = cursor.get(value.int_);
+        break;
+      case ObservationValue::Number:
+        valid = cursor.get(value.number_);
+        break;
+      case ObservationValue::String:
+        valid = cursor.get(value.string_);
+        break;
+    }
+    if (!valid) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+
+
+void encode_observation(std::string& out, const Observation& observation)
+{
+  put(out, observation.path_);
+  put(out, observation.observed_);
+  put(out, observation.fetched_);
+  put(out, static_cast<uint16_t>(observation.values_.size()));
+  for (const auto& value : observation.values_) {
+    put(out, value.name_);
+    put(out, static_cast<uint8_t>(value.type_));
+    switch (value.type_) {
+      case ObservationValue::Int:
+        put(out, value.int_);
+        break;
+      case ObservationValue::Number:
+        put(out, value.number_);
+        break;
+      case ObservationValue::String:
+        put(out, value.string_);
+        break;
+    }
+  }
+}
+
+
+bool decode_observation(const char* data, size_t size, Observation& observation)
+{
+  Cursor cursor(data, data + size);
+  return get_observation(cursor, observation) && cursor.done();
+}
+
+
+bool save_snapshot(const std::string& file_name, const std::vector<Observation>& observations)
+{
+  std::string out;
+  out.append(snapshot_magic, sizeof(snapshot_magic));
+  put(out, snapshot_version);
+  put(out, static_cast<uint32_t>(observations.size()));
+  for (const auto& observation : observations) {
+    encode_observation(out, observation);
+  }
+  put(out, crc32(out.data(), out.size()));
+
+  std::string temp_name = file_name + ".tmp";
+  FILE* file = std::fopen(temp_name.c_str(), "wb");
+  if (!file) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, temp_name << ": " << std::strerror(errno));
+    return false;
+  }
+  bool written = std::fwrite(out.data(), 1, out.size(), file) == out.size() && std::fflush(file) == 0 &&
+                 fsync(fileno(file)) == 0;
+  written = std::fclose(file) == 0 && written;
+  if (!written || std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, file_name << ": " << std::strerror(errno));
+    std::remove(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+bool load_snapshot(const std::string& file_name, std::vector<Observation>& observations)
+{
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::string in{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+  uint32_t checksum;
+  if (in.size() < sizeof(snapshot_magic) + sizeof(checksum)) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, file_name << ": truncated");
+    return false;
+  }
+  std::memcpy(&checksum, in.data() + in.size() - sizeof(checksum), sizeof(checksum));
+  if (std::memcmp(in.data(), snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+      checksum != crc32(in.data(), in.size() - sizeof(checksum))) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, file_name << ": checksum mismatch");
+    return false;
+  }
+
+  Cursor cursor(in.data() + sizeof(snapshot_magic), in.data() + in.size() - sizeof(checksum));
+  uint32_t version, count;
+  if (!cursor.get(version) || version != snapshot_version || !cursor.get(count)) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, file_name << ": unsupported version");
+    return false;
+  }
+
+  std::vector<Observation> result;
+  for (uint32_t i = 0; i < count; ++i) {
+    Observation observation;
+    if (!get_observation(cursor, observation)) {
+      break;
+    }
+    result.push_back(std::move(observation));
+  }
+
+  if (result.size() != count || !cursor.done()) {
+    LOG_EFM_ERROR(responder_error_code::snapshot_error, file_name << ": invalid record");
+    return false;
+  }
+  observations = std::move(result);
+  return true;
+}
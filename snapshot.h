@@ -0,0 +1,35 @@
+/// @file snapshot.h
+
+#pragma once
+
+#include "observation.h"
+
+#include <string>
+#include <vector>
+
+
+/// Writes the latest observations to a compact binary snapshot. The snapshot is written to a temporary file first and
+/// renamed over the old one, so a crash while writing never leaves a partial snapshot behind.
+/// @param file_name The snapshot file.
+/// @param observations The observations to store.
+/// @return false if the snapshot could not be written.
+bool save_snapshot(const std::string& file_name, const std::vector<Observation>& observations);
+
+/// Reads a snapshot written by save_snapshot.
+/// @param file_name The snapshot file.
+/// @param observations Receives the stored observations.
+/// @return false if the file is missing, truncated, of another version or fails its checksum. Nothing is returned
+/// from a snapshot which fails to load.
+bool load_snapshot(const std::string& file_name, std::vector<Observation>& observations);
+
+/// Appends the binary encoding of an observation, the one used by the snapshot.
+/// @param out Receives the encoded observation.
+/// @param observation The observation.
+void encode_observation(std::string& out, const Observation& observation);
+
+/// Decodes an observation encoded by encode_observation.
+/// @param data The encoded observation.
+/// @param size Size of the encoded observation.
+/// @param observation Receives the observation.
+/// @return false if the data is not exactly one valid observation.
+bool decode_observation(const char* data, size_t size, Observation& observation);
@@ -0,0 +1,277 @@
+#include "spill.h"
+#include "checksum.h"
+#include "error_code.h"
+#include "snapshot.h"
+
+#include <efm_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+const char spill_magic[8] = {'O', 'W', 'M', 'S', 'P', 'I', 'L', 'L'};
+const uint32_t spill_version = 1;
+const long header_size = sizeof(spill_magic) + sizeof(spill_version);
+
+// Layout of a segment, all integers in host byte order:
+//   magic[8] version:u32 { size:u32 crc32:u32 observation[size] }*
+// where observation is encoded by encode_observation and crc32 covers it.
+
+enum class Record
+{
+  Read,    ///< A complete record.
+  Damaged, ///< A complete record with a wrong checksum, the file is positioned after it.
+  End      ///< The end of the segment or an incomplete record.
+};
+
+/// Reads the record at the current position of a segment.
+/// @param left Bytes from the current position to the end of the segment.
+Record read_record(FILE* file, uint64_t left, std::string& buffer)
+{
+  uint32_t header[2];
+  // A damaged size must not allocate more than the segment holds.
+  if (left < sizeof(header) || std::fread(header, sizeof(header), 1, file) != 1 || header[0] > left - sizeof(header)) {
+    return Record::End;
+  }
+  buffer.resize(header[0]);
+  if (header[0] > 0 && std::fread(&buffer[0], header[0], 1, file) != 1) {
+    return Record::End;
+  }
+  return crc32(buffer.data(), buffer.size()) == header[1] ? Record::Read : Record::Damaged;
+}
+}
+
+
+Spill::Spill(std::string directory, uint64_t max_bytes)
+  : directory_(std::move(directory)), max_bytes_(max_bytes)
+  , segment_bytes_(std::max<uint64_t>(max_bytes / 8, 64 * 1024))
+{
+}
+
+
+Spill::~Spill()
+{
+  close_reader();
+  if (writer_) {
+    std::fclose(writer_);
+  }
+}
+
+
+bool Spill::open()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<uint32_t> sequences;
+  if (DIR* dir = opendir(directory_.c_str())) {
+    while (dirent* entry = readdir(dir)) {
+      unsigned sequence;
+      char suffix[8];
+      if (std::sscanf(entry->d_name, "spill-%8u.%3s", &sequence, suffix) == 2 && std::strcmp(suffix, "seg") == 0) {
+        sequences.push_back(sequence);
+      }
+    }
+    closedir(dir);
+  } else if (mkdir(directory_.c_str(), 0755) != 0) {
+    LOG_EFM_ERROR(responder_error_code::spill_error, directory_ << ": " << std::strerror(errno));
+    return false;
+  }
+  std::sort(sequences.begin(), sequences.end());
+
+  // The records of old segments are counted, a damaged tail is only noticed when it is read.
+  for (auto sequence : sequences) {
+    next_sequence_ = sequence + 1;
+    struct stat info;
+    if (stat(file_name(sequence).c_str(), &info) != 0 || info.st_size <= header_size) {
+      unlink(file_name(sequence).c_str());
+      continue;
+    }
+    Segment segment{sequence, static_cast<uint64_t>(info.st_size), 0};
+    if (FILE* file = std::fopen(file_name(sequence).c_str(), "rb")) {
+      uint32_t size;
+      long offset = header_size;
+      while (std::fseek(file, offset, SEEK_SET) == 0 && std::fread(&size, sizeof(size), 1, file) == 1) {
+        ++segment.records_;
+        offset += 2 * sizeof(uint32_t) + size;
+      }
+      std::fclose(file);
+    }
+    segments_.push_back(segment);
+    bytes_ += segment.bytes_;
+    records_ += segment.records_;
+  }
+  return true;
+}
+
+
+bool Spill::append(const Observation& observation)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  buffer_.assign(2 * sizeof(uint32_t), '\0');
+  encode_observation(buffer_, observation);
+  uint32_t header[2] = {static_cast<uint32_t>(buffer_.size() - sizeof(header)), 0};
+  header[1] = crc32(buffer_.data() + sizeof(header), header[0]);
+  std::memcpy(&buffer_[0], header, sizeof(header));
+
+  if ((!writer_ || segments_.back().bytes_ + buffer_.size() > segment_bytes_) && !start_segment()) {
+    return false;
+  }
+  // Flushed right away, so the reader sees only complete records.
+  if (std::fwrite(buffer_.data(), 1, buffer_.size(), writer_) != buffer_.size() || std::fflush(writer_) != 0) {
+    LOG_EFM_ERROR(responder_error_code::spill_error, file_name(segments_.back().sequence_) << ": " << std::strerror(errno));
+    std::fclose(writer_);
+    writer_ = nullptr;
+    return false;
+  }
+  segments_.back().bytes_ += buffer_.size();
+  ++segments_.back().records_;
+  bytes_ += buffer_.size();
+  ++records_;
+
+  while (bytes_ > max_bytes_ && segments_.size() > 1) {
+    dropped_ += segments_.front().records_ - read_records_;
+    drop_front();
+  }
+  return true;
+}
+
+
+size_t Spill::read(std::vector<Observation>& observations, size_t max)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  size_t count = 0;
+  while (count < max && !segments_.empty()) {
+    auto& front = segments_.front();
+    if (!reader_) {
+      reader_ = std::fopen(file_name(front.sequence_).c_str(), "rb");
+      read_offset_ = header_size;
+      read_records_ = 0;
+      char magic[sizeof(spill_magic)];
+      uint32_t version;
+      if (!reader_ || std::fread(magic, sizeof(magic), 1, reader_) != 1 ||
+          std::memcmp(magic, spill_magic, sizeof(magic)) != 0 || std::fread(&version, sizeof(version), 1, reader_) != 1 ||
+          version != spill_version) {
+        LOG_EFM_ERROR(responder_error_code::spill_error, file_name(front.sequence_) << ": not a spill segment");
+        dropped_ += front.records_;
+        drop_front();
+        continue;
+      }
+    }
+
+    bool last = writer_ && segments_.size() == 1;
+    Record record = Record::End;
+    if (std::fseek(reader_, read_offset_, SEEK_SET) == 0) {
+      record = read_record(reader_, front.bytes_ - std::min<uint64_t>(front.bytes_, read_offset_), buffer_);
+    }
+    if (record != Record::End) {
+      read_offset_ = std::ftell(reader_);
+      ++read_records_;
+      Observation observation;
+      if (record == Record::Read && decode_observation(buffer_.data(), buffer_.size(), observation)) {
+        observations.push_back(std::move(observation));
+        ++count;
+      } else {
+        LOG_EFM_ERROR(responder_error_code::spill_error, file_name(front.sequence_) << ": damaged observation skipped");
+        ++dropped_;
+      }
+      continue;
+    }
+
+    // The rest of the segment cannot be read, the records which were counted are lost. Also for the segment of the
+    // writer, which starts a new one with the next observation, so the reader never waits for a record it cannot read.
+    if (read_records_ < front.records_) {
+      LOG_EFM_ERROR(responder_error_code::spill_error,
+        file_name(front.sequence_) << ": " << front.records_ - read_records_ << " damaged observations skipped");
+      dropped_ += front.records_ - read_records_;
+    }
+    if (last) {
+      std::fclose(writer_);
+      writer_ = nullptr;
+      drop_front();
+      break;
+    }
+    drop_front();
+  }
+  return count;
+}
+
+
+uint64_t Spill::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return records_ - read_records_;
+}
+
+
+uint64_t Spill::dropped() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+
+std::string Spill::file_name(uint32_t sequence) const
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "/spill-%08u.seg", sequence);
+  return directory_ + name;
+}
+
+
+bool Spill::start_segment()
+{
+  if (writer_) {
+    std::fclose(writer_);
+    writer_ = nullptr;
+  }
+
+  Segment segment{next_sequence_++, static_cast<uint64_t>(header_size), 0};
+  std::string name = file_name(segment.sequence_);
+  writer_ = std::fopen(name.c_str(), "wb");
+  if (!writer_ || std::fwrite(spill_magic, sizeof(spill_magic), 1, writer_) != 1 ||
+      std::fwrite(&spill_version, sizeof(spill_version), 1, writer_) != 1 || std::fflush(writer_) != 0) {
+    LOG_EFM_ERROR(responder_error_code::spill_error, name << ": " << std::strerror(errno));
+    if (writer_) {
+      std::fclose(writer_);
+      writer_ = nullptr;
+      unlink(name.c_str());
+    }
+    return false;
+  }
+  segments_.push_back(segment);
+  bytes_ += segment.bytes_;
+  return true;
+}
+
+
+void Spill::drop_front()
+{
+  auto& front = segments_.front();
+  if (reader_) {
+    close_reader();
+  }
+  unlink(file_name(front.sequence_).c_str());
+  bytes_ -= front.bytes_;
+  records_ -= front.records_;
+  segments_.pop_front();
+}
+
+
+void Spill::close_reader()
+{
+  if (reader_) {
+    std::fclose(reader_);
+    reader_ = nullptr;
+  }
+  read_offset_ = 0;
+  read_records_ = 0;
+}
@@ -0,0 +1,84 @@
+/// @file spill.h
+
+#pragma once
+
+#include "observation.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// @brief Bounded on-disk FIFO of observations, which keeps them while the broker is unreachable.
+/// Observations are appended to segment files in a directory. Every record carries its own length and checksum, a
+/// segment is deleted once it has been read completely. If the spill outgrows its size limit, the oldest segment is
+/// dropped with the observations in it. Segments left by a previous run are read first, so nothing is lost across a
+/// restart while disconnected. Thread safe.
+class Spill
+{
+public:
+  /// Constructs a spill, open() has to be called before it is used.
+  /// @param directory Directory of the segment files, created if missing.
+  /// @param max_bytes Maximum size of all segments together.
+  Spill(std::string directory, uint64_t max_bytes);
+  ~Spill();
+
+  Spill(const Spill&) = delete;
+  Spill& operator=(const Spill&) = delete;
+
+  /// Opens the directory and picks up the segments left by a previous run.
+  /// @return false if the directory could not be created.
+  bool open();
+
+  /// Appends an observation.
+  /// @param observation The observation.
+  /// @return false if it could not be written.
+  bool append(const Observation& observation);
+
+  /// Reads the oldest observations and removes them from the spill.
+  /// @param observations Receives the observations, appended in the order they were spilled.
+  /// @param max Maximum number of observations to read.
+  /// @return The number of observations read.
+  size_t read(std::vector<Observation>& observations, size_t max);
+
+  /// Returns the number of observations which have not been read yet. Counts the incomplete records of segments from
+  /// a previous run until they are read.
+  /// @return The number of observations.
+  uint64_t size() const;
+
+  /// Returns the number of observations dropped because the spill was full or damaged.
+  /// @return The number of observations.
+  uint64_t dropped() const;
+
+private:
+  struct Segment
+  {
+    uint32_t sequence_;
+    uint64_t bytes_;
+    uint64_t records_;
+  };
+
+  std::string file_name(uint32_t sequence) const;
+  bool start_segment();
+  void drop_front();
+  void close_reader();
+
+  const std::string directory_;
+  const uint64_t max_bytes_;
+  const uint64_t segment_bytes_;
+
+  mutable std::mutex mutex_;
+  std::deque<Segment> segments_; ///< Oldest first, the last one is written if writer_ is open.
+  uint64_t bytes_{0};            ///< Size of all segments.
+  uint64_t records_{0};          ///< Records of all segments, including the ones read from the first segment.
+  FILE* writer_{nullptr};
+  FILE* reader_{nullptr};   ///< Reads the first segment.
+  long read_offset_{0};     ///< Offset of the next record in the first segment.
+  uint64_t read_records_{0}; ///< Records read from the first segment.
+  uint32_t next_sequence_{0};
+  uint64_t dropped_{0};
+  std::string buffer_;
+};
@@ -0,0 +1,44 @@
+#include "subscriptions.h"
+
+
+Subscriptions::Subscriptions(const std::vector<Location>& locations)
+  : counts_(locations.size())
+{
+  for (const auto& location : locations) {
+    paths_.push_back(location.path_);
+  }
+}
+
+
+size_t Subscriptions::find(const std::string& path) const
+{
+  size_t found = npos;
+  size_t found_length = 0;
+  for (size_t i = 0; i < paths_.size(); ++i) {
+    const auto& prefix = paths_[i];
+    bool root = prefix == "/";
+    bool contains = root || (path.compare(0, prefix.size(), prefix) == 0 &&
+                              (path.size() == prefix.size() || path[prefix.size()] == '/'));
+    if (contains && (found == npos || prefix.size() > found_length)) {
+      found = i;
+      found_length = prefix.size();
+    }
+  }
+  return found;
+}
+
+
+void Subscriptions::changed(size_t location, bool subscribe)
+{
+  if (location >= counts_.size()) {
+    return;
+  }
+  if (subscribe) {
+    ++counts_[location];
+  } else {
+    // Never below zero, e.g. if an unsubscribe of a node created before a restart of the broker connection arrives.
+    int count = counts_[location];
+    while (count > 0 && !counts_[location].compare_exchange_weak(count, count - 1)) {
+    }
+  }
+}
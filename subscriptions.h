@@ -0,0 +1,45 @@
+/// @file subscriptions.h
+
+#pragma once
+
+#include "location.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+/// @brief Counts the subscribers of the value nodes of every location. Thread safe.
+/// A node belongs to the location whose path is the longest prefix of the node path, e.g. `/paris/air/aqi` belongs to
+/// `/paris` and `/OpenWeatherData` to `/`.
+class Subscriptions
+{
+public:
+  /// Constructs the counters.
+  /// @param locations The configured locations, the counters are indexed like them.
+  explicit Subscriptions(const std::vector<Location>& locations);
+
+  /// Finds the location a node belongs to.
+  /// @param path Path of the node.
+  /// @return The index of the location or npos if the node does not belong to a location.
+  size_t find(const std::string& path) const;
+
+  /// Counts a subscribe or unsubscribe of a node of a location.
+  /// @param location Index of the location.
+  /// @param subscribe true for a subscribe, false for an unsubscribe.
+  void changed(size_t location, bool subscribe);
+
+  /// Returns whether a node of a location is subscribed.
+  /// @param location Index of the location.
+  /// @return true if there is at least one subscriber.
+  bool subscribed(size_t location) const
+  {
+    return counts_[location] > 0;
+  }
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+private:
+  std::vector<std::string> paths_;
+  std::vector<std::atomic<int>> counts_;
+};
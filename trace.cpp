@@ -0,0 +1,205 @@
+#include "trace.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace rapidjson;
+
+
+namespace
+{
+struct Event
+{
+  const char* name_;
+  int64_t start_;    ///< µs since the start of the process.
+  int64_t duration_; ///< µs.
+  char detail_[40];
+};
+
+
+/// The spans of one thread. Only its thread writes, the mutex is only contended while the spans are exported.
+struct ThreadBuffer
+{
+  static const size_t capacity = 4096;
+
+  std::mutex mutex_;
+  uint32_t thread_{0};
+  std::vector<Event> events_;
+  size_t next_{0};
+  bool wrapped_{false};
+};
+
+
+std::atomic<uint64_t> sample_period{100};
+std::atomic<uint64_t> cycles{0};
+std::atomic<uint32_t> threads{0};
+std::mutex buffers_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+const auto epoch = std::chrono::steady_clock::now();
+
+/// Owns the buffer of a thread. The spans of a thread are dropped when it ends.
+struct LocalBuffer
+{
+  std::shared_ptr<ThreadBuffer> buffer_;
+
+  ~LocalBuffer()
+  {
+    if (buffer_) {
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer_), buffers.end());
+    }
+  }
+};
+
+thread_local bool traced = false;
+thread_local LocalBuffer local_buffer;
+
+
+int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+ThreadBuffer& thread_buffer()
+{
+  auto& buffer = local_buffer.buffer_;
+  if (!buffer) {
+    buffer = std::make_shared<ThreadBuffer>();
+    buffer->events_.resize(ThreadBuffer::capacity);
+    buffer->thread_ = ++threads;
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.push_back(buffer);
+  }
+  return *buffer;
+}
+}
+
+
+void Trace::set_sample_percent(double percent)
+{
+  sample_period = percent <= 0 ? 0 : std::max<uint64_t>(1, static_cast<uint64_t>(std::lround(100 / percent)));
+}
+
+
+bool Trace::sampled()
+{
+  return traced;
+}
+
+
+size_t Trace::export_chrome_json(std::string& json)
+{
+  std::vector<std::shared_ptr<ThreadBuffer>> current;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    current = buffers;
+  }
+
+  StringBuffer buffer;
+  Writer<StringBuffer> writer(buffer);
+  size_t count = 0;
+  writer.StartObject();
+  writer.Key("displayTimeUnit");
+  writer.String("ms");
+  writer.Key("traceEvents");
+  writer.StartArray();
+  for (const auto& thread : current) {
+    std::lock_guard<std::mutex> lock(thread->mutex_);
+    size_t size = thread->wrapped_ ? ThreadBuffer::capacity : thread->next_;
+    size_t first = thread->wrapped_ ? thread->next_ : 0;
+    for (size_t i = 0; i < size; ++i) {
+      const auto& event = thread->events_[(first + i) % ThreadBuffer::capacity];
+      writer.StartObject();
+      writer.Key("name");
+      writer.String(event.name_);
+      writer.Key("cat");
+      writer.String("pipeline");
+      writer.Key("ph");
+      writer.String("X");
+      writer.Key("ts");
+      writer.Int64(event.start_);
+      writer.Key("dur");
+      writer.Int64(event.duration_);
+      writer.Key("pid");
+      writer.Int(1);
+      writer.Key("tid");
+      writer.Uint(thread->thread_);
+      if (event.detail_[0]) {
+        writer.Key("args");
+        writer.StartObject();
+        writer.Key("detail");
+        writer.String(event.detail_);
+        writer.EndObject();
+      }
+      writer.EndObject();
+      ++count;
+    }
+  }
+  writer.EndArray();
+  writer.EndObject();
+
+  json.assign(buffer.GetString(), buffer.GetSize());
+  return count;
+}
+
+
+TraceCycle::TraceCycle()
+  : previous_(traced)
+{
+  uint64_t period = sample_period.load(std::memory_order_relaxed);
+  traced = period > 0 && cycles.fetch_add(1, std::memory_order_relaxed) % period == 0;
+}
+
+
+TraceCycle::TraceCycle(bool sampled)
+  : previous_(traced)
+{
+  traced = sampled;
+}
+
+
+TraceCycle::~TraceCycle()
+{
+  traced = previous_;
+}
+
+
+TraceSpan::TraceSpan(const char* name, const std::string& detail)
+  : name_(traced ? name : nullptr)
+{
+  if (name_) {
+    size_t length = std::min(detail.size(), sizeof(detail_) - 1);
+    std::memcpy(detail_, detail.data(), length);
+    detail_[length] = '\0';
+    start_ = now();
+  }
+}
+
+
+TraceSpan::~TraceSpan()
+{
+  if (!name_) {
+    return;
+  }
+  int64_t end = now();
+  auto& buffer = thread_buffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex_);
+  auto& event = buffer.events_[buffer.next_];
+  event.name_ = name_;
+  event.start_ = start_;
+  event.duration_ = end - start_;
+  std::memcpy(event.detail_, detail_, sizeof(detail_));
+  if (++buffer.next_ == ThreadBuffer::capacity) {
+    buffer.next_ = 0;
+    buffer.wrapped_ = true;
+  }
+}
@@ -0,0 +1,70 @@
+/// @file trace.h
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+/// @brief Pipeline tracing. Spans of sampled poll cycles are kept in a ring per thread and can be exported in the
+/// Chrome trace-event format (chrome://tracing, Perfetto).
+/// Whether a cycle is traced is decided once when it starts, a span outside of a traced cycle costs a thread local
+/// read. Each ring keeps the last 4096 spans of its thread, until the thread ends. Thread safe.
+class Trace
+{
+public:
+  /// Sets the share of cycles which are traced.
+  /// @param percent Share in percent, 0 disables tracing.
+  static void set_sample_percent(double percent);
+
+  /// Returns whether the current thread is in a traced cycle.
+  /// @return true if spans are recorded.
+  static bool sampled();
+
+  /// Writes the recorded spans of all threads as Chrome trace-event JSON.
+  /// @param json Receives the JSON document.
+  /// @return The number of spans.
+  static size_t export_chrome_json(std::string& json);
+};
+
+
+/// @brief Scope of a cycle, e.g. one poll of an endpoint. Decides whether the spans within are recorded.
+class TraceCycle
+{
+public:
+  /// Starts a cycle which is traced according to the sample rate.
+  TraceCycle();
+
+  /// Starts a cycle which continues another one, e.g. on another thread.
+  /// @param sampled Whether the other cycle is traced.
+  explicit TraceCycle(bool sampled);
+
+  ~TraceCycle();
+
+  TraceCycle(const TraceCycle&) = delete;
+  TraceCycle& operator=(const TraceCycle&) = delete;
+
+private:
+  bool previous_;
+};
+
+
+/// @brief Records the time from its construction to its destruction as span, if the cycle is traced.
+class TraceSpan
+{
+public:
+  /// Starts a span.
+  /// @param name Name of the span, has to be a string literal.
+  /// @param detail Shown as argument of the span, e.g. the location, truncated to 39 characters.
+  explicit TraceSpan(const char* name, const std::string& detail = std::string());
+
+  ~TraceSpan();
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* name_; ///< nullptr if the cycle is not traced.
+  int64_t start_;
+  char detail_[40];
+};
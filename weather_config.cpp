@@ -0,0 +1,202 @@
+#include "weather_config.h"
+#include "error_code.h"
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+
+#include <efm_logging.h>
+
+#include <fstream>
+#include <utility>
+#include <sstream>
+
+using namespace rapidjson;
+
+
+namespace
+{
+/// Reads a stage object like {"threads": 2, "cpus": [0, 1]}, missing members keep their value.
+bool load_stage(const Value& value, StageConfig& stage)
+{
+  if (!value.IsObject()) {
+    return false;
+  }
+  if (value.HasMember("threads")) {
+    if (!value["threads"].IsUint() || value["threads"].GetUint() == 0) {
+      return false;
+    }
+    stage.threads_ = value["threads"].GetUint();
+  }
+  if (value.HasMember("cpus")) {
+    if (!value["cpus"].IsArray()) {
+      return false;
+    }
+    stage.cpus_.clear();
+    for (const auto& cpu : value["cpus"].GetArray()) {
+      if (!cpu.IsUint()) {
+        return false;
+      }
+      stage.cpus_.push_back(static_cast<int>(cpu.GetUint()));
+    }
+  }
+  return true;
+}
+}
+
+bool WeatherConfig::load(const std::string& file_name)
+{
+  std::ifstream file(file_name);
+  if (!file) {
+    return true;
+  }
+
+  std::stringstream content;
+  content << file.rdbuf();
+
+  Document d;
+  d.Parse(content.str().c_str());
+  if (d.HasParseError() || !d.IsObject()) {
+    LOG_EFM_ERROR(responder_error_code::config_error, file_name << ": " << GetParseError_En(d.GetParseError()));
+    return false;
+  }
+
+  if (d.HasMember("api_key") && d["api_key"].IsString()) {
+    api_key = d["api_key"].GetString();
+  }
+  if (d.HasMember("locations") && d["locations"].IsArray()) {
+    locations.clear();
+    for (const auto& entry : d["locations"].GetArray()) {
+      if (!entry.IsObject() || !entry.HasMember("path") || !entry["path"].IsString() || !entry.HasMember("query") ||
+          !entry["query"].IsString()) {
+        LOG_EFM_ERROR(responder_error_code::config_error, file_name << ": locations need a path and a query");
+        return false;
+      }
+      Location location{};
+      location.path_ = entry["path"].GetString();
+      location.query_ = entry["query"].GetString();
+      if (entry.HasMember("lat") && entry["lat"].IsNumber()) {
+        location.latitude_ = entry["lat"].GetDouble();
+      }
+      if (entry.HasMember("lon") && entry["lon"].IsNumber()) {
+        location.longitude_ = entry["lon"].GetDouble();
+      }
+      locations.push_back(location);
+    }
+  }
+  if (d.HasMember("requests_per_minute") && d["requests_per_minute"].IsUint()) {
+    requests_per_minute = d["requests_per_minute"].GetUint();
+  }
+  if (d.HasMember("http_connections") && d["http_connections"].IsUint()) {
+    http_connections = d["http_connections"].GetUint();
+  }
+  if (d.HasMember("http_streams") && d["http_streams"].IsUint()) {
+    http_streams = d["http_streams"].GetUint();
+  }
+  if (d.HasMember("http_connect_timeout_seconds") && d["http_connect_timeout_seconds"].IsUint()) {
+    http_connect_timeout = std::chrono::seconds(d["http_connect_timeout_seconds"].GetUint());
+  }
+  if (d.HasMember("http_timeout_seconds") && d["http_timeout_seconds"].IsUint()) {
+    http_timeout = std::chrono::seconds(d["http_timeout_seconds"].GetUint());
+  }
+  if (d.HasMember("poll_interval_seconds") && d["poll_interval_seconds"].IsUint()) {
+    poll_interval = std::chrono::seconds(d["poll_interval_seconds"].GetUint());
+  }
+  if (d.HasMember("forecast_interval_minutes") && d["forecast_interval_minutes"].IsUint()) {
+    forecast_interval = std::chrono::minutes(d["forecast_interval_minutes"].GetUint());
+  }
+  if (d.HasMember("air_pollution_interval_minutes") && d["air_pollution_interval_minutes"].IsUint()) {
+    air_pollution_interval = std::chrono::minutes(d["air_pollution_interval_minutes"].GetUint());
+  }
+  if (d.HasMember("background_interval_minutes") && d["background_interval_minutes"].IsUint()) {
+    background_interval = std::chrono::minutes(d["background_interval_minutes"].GetUint());
+  }
+  if (d.HasMember("history_hours") && d["history_hours"].IsUint()) {
+    history_retention = std::chrono::hours(d["history_hours"].GetUint());
+  }
+  if (d.HasMember("history_dir") && d["history_dir"].IsString()) {
+    history_dir = d["history_dir"].GetString();
+  }
+  if (d.HasMember("history_segment_mb") && d["history_segment_mb"].IsUint()) {
+    history_segment_mb = d["history_segment_mb"].GetUint();
+  }
+  if (d.HasMember("history_segment_minutes") && d["history_segment_minutes"].IsUint()) {
+    history_segment_duration = std::chrono::minutes(d["history_segment_minutes"].GetUint());
+  }
+  if (d.HasMember("snapshot_file") && d["snapshot_file"].IsString()) {
+    snapshot_file = d["snapshot_file"].GetString();
+  }
+  if (d.HasMember("snapshot_interval_seconds") && d["snapshot_interval_seconds"].IsUint()) {
+    snapshot_interval = std::chrono::seconds(d["snapshot_interval_seconds"].GetUint());
+  }
+  if (d.HasMember("city_list") && d["city_list"].IsString()) {
+    city_list = d["city_list"].GetString();
+  }
+  if (d.HasMember("city_catalog") && d["city_catalog"].IsString()) {
+    city_catalog = d["city_catalog"].GetString();
+  }
+  if (d.HasMember("catalog_idle_minutes") && d["catalog_idle_minutes"].IsUint()) {
+    catalog_idle = std::chrono::minutes(d["catalog_idle_minutes"].GetUint());
+  }
+  if (d.HasMember("payload_dump_interval_seconds") && d["payload_dump_interval_seconds"].IsUint()) {
+    payload_dump_interval = std::chrono::seconds(d["payload_dump_interval_seconds"].GetUint());
+  }
+  if (d.HasMember("metrics_interval_seconds") && d["metrics_interval_seconds"].IsUint()) {
+    metrics_interval = std::chrono::seconds(d["metrics_interval_seconds"].GetUint());
+  }
+  if (d.HasMember("trace_sample_percent") && d["trace_sample_percent"].IsNumber()) {
+    trace_sample_percent = d["trace_sample_percent"].GetDouble();
+  }
+  if (d.HasMember("record_file") && d["record_file"].IsString()) {
+    record_file = d["record_file"].GetString();
+  }
+  const std::pair<const char*, StageConfig*> stages[] = {
+    {"fetch_stage", &fetch_stage}, {"parse_stage", &parse_stage}, {"publish_stage", &publish_stage}};
+  for (const auto& stage : stages) {
+    if (d.HasMember(stage.first) && !load_stage(d[stage.first], *stage.second)) {
+      LOG_EFM_ERROR(responder_error_code::config_error,
+        file_name << ": " << stage.first << " needs a positive thread count and a list of CPUs");
+      return false;
+    }
+  }
+  if (d.HasMember("stage_queue_capacity") && d["stage_queue_capacity"].IsUint()) {
+    stage_queue_capacity = d["stage_queue_capacity"].GetUint();
+  }
+  if (d.HasMember("publish_budget") && d["publish_budget"].IsUint()) {
+    publish_budget = d["publish_budget"].GetUint();
+  }
+  if (d.HasMember("parse_split_kb") && d["parse_split_kb"].IsUint()) {
+    parse_split_kb = d["parse_split_kb"].GetUint();
+  }
+  if (d.HasMember("spill_dir") && d["spill_dir"].IsString()) {
+    spill_dir = d["spill_dir"].GetString();
+  }
+  if (d.HasMember("spill_mb") && d["spill_mb"].IsUint()) {
+    spill_mb = d["spill_mb"].GetUint();
+  }
+
+
+  // A 0 would make a timer fire continuously or a queue or file hold nothing. The settings where 0 disables a feature
+  // or lifts a limit, like publish_budget, are documented as such.
+  const std::pair<const char*, bool> zero[] = {
+    {"poll_interval_seconds", poll_interval.count() == 0},
+    {"history_hours", history_retention.count() == 0},
+    {"history_segment_mb", history_segment_mb == 0},
+    {"history_segment_minutes", history_segment_duration.count() == 0},
+    {"snapshot_interval_seconds", snapshot_interval.count() == 0},
+    {"catalog_idle_minutes", catalog_idle.count() == 0},
+    {"stage_queue_capacity", stage_queue_capacity == 0},
+    {"spill_mb", spill_mb == 0}};
+  for (const auto& setting : zero) {
+    if (setting.second) {
+      LOG_EFM_ERROR(responder_error_code::config_error, file_name << ": " << setting.first << " must be at least 1");
+      return false;
+    }
+  }
+  // The batches are set in the order they were flushed, a second worker could overtake a value with an older one.
+  if (publish_stage.threads_ != 1) {
+    LOG_EFM_ERROR(responder_error_code::config_error, file_name << ": publish_stage must have exactly 1 thread");
+    return false;
+  }
+
+  return true;
+}
+
@@ -0,0 +1,54 @@
+/// @file weather_config.h
+
+#pragma once
+
+#include "location.h"
+#include "pipeline.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+/// Link specific settings which are not covered by the SDK's LinkOptions. They are read from a JSON file next to
+/// dslink.json, every missing key keeps its default.
+struct WeatherConfig
+{
+  std::string api_key{"8fdc9a1f1fb74ac9dfed4803a57b02c6"}; ///< OpenWeatherMap API key.
+  std::vector<Location> locations{{"/", "q=London,uk", 51.5085, -0.1257}}; ///< The polled locations.
+  unsigned requests_per_minute{60};          ///< Rate limit of all API requests, 0 for none.
+  unsigned http_connections{2};              ///< Maximum number of connections to the API, 0 for no limit.
+  unsigned http_streams{100};                ///< Maximum number of concurrent requests on an HTTP/2 connection, 0 for the server's limit.
+  std::chrono::seconds http_connect_timeout{10}; ///< Maximum time to connect to the API, 0 for no limit.
+  std::chrono::seconds http_timeout{30};     ///< Maximum time of an API request, 0 for no limit.
+  std::chrono::seconds poll_interval{60};   ///< Delay between two polls of the weather API.
+  std::chrono::minutes forecast_interval{30}; ///< Delay between two polls of the forecast API, 0 disables them.
+  std::chrono::minutes air_pollution_interval{60}; ///< Delay between two polls of the air pollution API, 0 disables them.
+  std::chrono::minutes background_interval{60}; ///< Delay between two polls of locations nobody subscribed to, 0 polls them always.
+  std::chrono::hours history_retention{24}; ///< How far back the compressed history of every metric reaches.
+  std::string history_dir;                  ///< Directory of the history segments, empty keeps history in memory only.
+  size_t history_segment_mb{64};            ///< Maximum size of a history segment file.
+  std::chrono::minutes history_segment_duration{60}; ///< Maximum time span a history segment is written to.
+  std::string snapshot_file{"observations.snapshot"}; ///< Snapshot of the latest observations, empty disables it.
+  std::chrono::seconds snapshot_interval{60};        ///< Delay between two snapshots.
+  std::string city_list;                             ///< OpenWeatherMap city.list.json(.gz) to import, empty for none.
+  std::string city_catalog{"cities.catalog"};        ///< Mapped catalog built from city_list, empty disables it.
+  std::chrono::minutes catalog_idle{10};             ///< Time after which unused city nodes of /catalog are removed.
+  std::chrono::seconds payload_dump_interval{60};    ///< Minimum time between two response dumps at log level debug.
+  std::chrono::seconds metrics_interval{10};         ///< Delay between two updates of /metrics, 0 disables them.
+  double trace_sample_percent{1};                    ///< Share of the poll cycles which are traced, 0 disables tracing.
+  std::string record_file;                           ///< Recording of all responses for the replay tool, empty for none.
+  StageConfig fetch_stage{4, {}};                    ///< Workers which run the API requests.
+  StageConfig parse_stage{1, {}};                    ///< Workers which parse the responses and publish the results.
+  StageConfig publish_stage{1, {}};                  ///< Worker which hands the value batches to the responder, always 1.
+  size_t stage_queue_capacity{256};                  ///< Maximum number of jobs waiting for a stage.
+  size_t publish_budget{10000};                      ///< Maximum number of values waiting for the broker, 0 for no limit.
+  size_t parse_split_kb{8};                          ///< Minimum part size a forecast is split into by the parse stage, 0 disables splitting.
+  std::string spill_dir{"spill"};                    ///< Directory of the observations kept while disconnected, empty disables it.
+  size_t spill_mb{64};                               ///< Maximum size of the spill, the oldest observations are dropped beyond it.
+
+  /// Loads the settings from the given file. A missing file is not an error, the defaults are kept.
+  /// @param file_name The JSON file to load.
+  /// @return false if the file exists but could not be parsed.
+  bool load(const std::string& file_name);
+};